@@ -1,7 +1,39 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h> // For strncasecmp
 #include <ctype.h> // For tolower, isdigit
+#include <pthread.h> // For parallel scans
+#include <time.h>    // For clock_gettime in the benchmark
+#include <unistd.h>  // For sysconf
+#include <fcntl.h>     // For open
+#include <sys/mman.h>  // For mmap in lazy mode
+#include <sys/stat.h>  // For fstat
+#include <sys/uio.h>   // For struct iovec
+#include <sys/syscall.h> // For the io_uring system calls
+#include <errno.h>
+#include <math.h>      // For the statistics sketches
+#include <limits.h>    // For INT_MIN/INT_MAX in the zone maps
+#include <float.h>     // For FLT_MAX in the zone maps
+#include <stdint.h>    // For SIZE_MAX
+#include <sys/ioctl.h> // For controlling perf counters
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/perf_event.h>)
+#include <linux/perf_event.h>
+#define HAVE_PERF_EVENT 1
+#endif
+#endif
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>    // For gzip-compressed input
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>    // For zstd-compressed input
+#endif
 
 // Define the struct for a movie
 typedef struct Movie {
@@ -10,337 +42,6504 @@ typedef struct Movie {
     char languages[256]; // Semicolon-separated languages
     float rating;
     struct Movie *next; // Pointer to the next movie in the list
+    size_t rowId;       // Position of the movie in the dataset's row table
+
+    // Lazy mode only: where the raw title and languages live in the mapped file.
+    // They are decoded into title/languages the first time they are needed, so
+    // lazy mode saves parsing time but not memory: every node keeps both arrays.
+    const char* source;     // Mapped file, or NULL when both fields are decoded
+    size_t titleOffset;
+    size_t languagesOffset;
+    unsigned short titleLength;
+    unsigned short languagesLength;
+    unsigned char decoded;  // MOVIE_TITLE_DECODED | MOVIE_LANGUAGES_DECODED
 } Movie;
 
-// Function to create a new movie node
-Movie* createMovieNode(const char* title, int year, const char* languages, float rating) {
-    Movie* newNode = (Movie*)malloc(sizeof(Movie));
-    if (newNode == NULL) {
-        perror("Failed to allocate memory for new movie node");
-        exit(EXIT_FAILURE);
+#define MOVIE_TITLE_DECODED     0x1
+#define MOVIE_LANGUAGES_DECODED 0x2
+
+// Function to copy a languages field, removing the square brackets if present
+static void copyLanguages(char* dest, size_t destSize, const char* languages, size_t length) {
+    if (length >= 2 && languages[0] == '[' && languages[length - 1] == ']') {
+        languages++;
+        length -= 2;
+    }
+    if (length > destSize - 1) {
+        length = destSize - 1;
+    }
+    memcpy(dest, languages, length);
+    dest[length] = '\0';
+}
+
+// Function to fill in a movie node
+static void initMovieNode(Movie* newNode, const char* title, int year, const char* languages, float rating) {
+    strncpy(newNode->title, title, sizeof(newNode->title) - 1);
+    newNode->title[sizeof(newNode->title) - 1] = '\0'; // Ensure null-termination
+    newNode->year = year;
+
+    // Remove square brackets from languages string if present
+    copyLanguages(newNode->languages, sizeof(newNode->languages), languages, strlen(languages));
+
+    newNode->rating = rating;
+    newNode->next = NULL;
+    newNode->source = NULL;
+    newNode->decoded = MOVIE_TITLE_DECODED | MOVIE_LANGUAGES_DECODED;
+}
+
+// Function to create a new movie node
+Movie* createMovieNode(const char* title, int year, const char* languages, float rating) {
+    Movie* newNode = (Movie*)malloc(sizeof(Movie));
+    if (newNode == NULL) {
+        perror("Failed to allocate memory for new movie node");
+        exit(EXIT_FAILURE);
+    }
+    initMovieNode(newNode, title, year, languages, rating);
+    return newNode;
+}
+
+// Function to fill in a movie node in lazy mode: only the year and rating are
+// stored, the title and languages are recorded as byte ranges of `source`
+static void initLazyMovieNode(Movie* newNode, const char* source, size_t titleOffset, size_t titleLength,
+                              size_t languagesOffset, size_t languagesLength, int year, float rating) {
+    newNode->year = year;
+    newNode->rating = rating;
+    newNode->next = NULL;
+    newNode->source = source;
+    newNode->titleOffset = titleOffset;
+    newNode->titleLength = (unsigned short)titleLength;
+    newNode->languagesOffset = languagesOffset;
+    newNode->languagesLength = (unsigned short)languagesLength;
+    newNode->decoded = 0;
+}
+
+// Function to get a movie's title, decoding it from the mapped file on first use.
+// The decoded value is cached in the node, which is why a const node may be
+// written. This is safe because nodes always live in writable memory owned by
+// the dataset, even for a shared dataset whose records they decode from, and a
+// scan gives each row to only one worker.
+const char* movieTitle(const Movie* movie) {
+    if (!(movie->decoded & MOVIE_TITLE_DECODED)) {
+        Movie* node = (Movie*)movie;
+        memcpy(node->title, node->source + node->titleOffset, node->titleLength);
+        node->title[node->titleLength] = '\0';
+        node->decoded |= MOVIE_TITLE_DECODED;
+    }
+    return movie->title;
+}
+
+// Function to get a movie's languages, decoding them from the mapped file on first use
+const char* movieLanguages(const Movie* movie) {
+    if (!(movie->decoded & MOVIE_LANGUAGES_DECODED)) {
+        Movie* node = (Movie*)movie;
+        copyLanguages(node->languages, sizeof(node->languages),
+                      node->source + node->languagesOffset, node->languagesLength);
+        node->decoded |= MOVIE_LANGUAGES_DECODED;
+    }
+    return movie->languages;
+}
+
+// Function to add a movie node to the end of the linked list
+void addMovieToList(Movie** head, Movie* newNode) {
+    if (*head == NULL) {
+        *head = newNode;
+    } else {
+        Movie* current = *head;
+        while (current->next != NULL) {
+            current = current->next;
+        }
+        current->next = newNode;
+    }
+}
+
+// 64-bit hash of a byte string: FNV-1a followed by a MurmurHash3 finalizer so
+// every output bit depends on every input byte, as the Bloom filters
+// and sketches require
+static unsigned long long hashBytes(const char* bytes, size_t length) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)bytes[i]) * 1099511628211ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Rows per block of the row table. Each block keeps a summary that lets scans
+// skip it without looking at its rows.
+#define ROW_BLOCK_SIZE 1024
+
+// Bits in the Bloom filter of a block, and probes per language
+#define BLOCK_BLOOM_BITS 2048
+#define BLOCK_BLOOM_PROBES 3
+
+// Zone map and language Bloom filter of one block of rows. It holds no
+// pointers so the array of summaries can be written out next to the rows.
+typedef struct BlockSummary {
+    int minYear;
+    int maxYear;
+    float minRating;
+    float maxRating;
+    unsigned long long bloom[BLOCK_BLOOM_BITS / 64];
+} BlockSummary;
+
+// Function to get the hash of a language, ignoring case and surrounding spaces
+static unsigned long long languageHash(const char* start, const char* end) {
+    char lowered[256];
+    size_t length = 0;
+    while (start < end && *start == ' ') start++;
+    while (end > start && end[-1] == ' ') end--;
+    for (; start < end && length < sizeof(lowered); start++) {
+        lowered[length++] = tolower((unsigned char)*start);
+    }
+    return hashBytes(lowered, length);
+}
+
+// Function to get the i-th Bloom filter bit of a language hash (double hashing)
+static unsigned int bloomBit(unsigned long long hash, int probe) {
+    unsigned int h1 = (unsigned int)hash;
+    unsigned int h2 = (unsigned int)(hash >> 32) | 1;
+    return (h1 + probe * h2) % BLOCK_BLOOM_BITS;
+}
+
+// Function to add a ';'-separated list of languages to a block's Bloom filter
+static void bloomAddLanguages(BlockSummary* block, const char* list, const char* listEnd) {
+    const char* token = list;
+    while (token < listEnd) {
+        const char* tokenEnd = (const char*)memchr(token, ';', listEnd - token);
+        if (tokenEnd == NULL) {
+            tokenEnd = listEnd;
+        }
+        unsigned long long hash = languageHash(token, tokenEnd);
+        for (int probe = 0; probe < BLOCK_BLOOM_PROBES; probe++) {
+            unsigned int bit = bloomBit(hash, probe);
+            block->bloom[bit / 64] |= 1ULL << (bit % 64);
+        }
+        token = tokenEnd + 1;
+    }
+}
+
+// Function to get a movie's ';'-separated languages without decoding the node:
+// in lazy mode they are read from the mapped file, without the brackets
+static void movieLanguageSpan(const Movie* movie, const char** list, size_t* length) {
+    if (movie->decoded & MOVIE_LANGUAGES_DECODED) {
+        *list = movie->languages;
+        *length = strlen(movie->languages);
+    } else {
+        *list = movie->source + movie->languagesOffset;
+        *length = movie->languagesLength;
+        if (*length >= 2 && (*list)[0] == '[' && (*list)[*length - 1] == ']') {
+            (*list)++;
+            *length -= 2;
+        }
+    }
+}
+
+// Function to widen a block's summary to cover one more movie
+static void blockSummaryAdd(BlockSummary* block, const Movie* movie) {
+    if (movie->year < block->minYear) block->minYear = movie->year;
+    if (movie->year > block->maxYear) block->maxYear = movie->year;
+    if (movie->rating < block->minRating) block->minRating = movie->rating;
+    if (movie->rating > block->maxRating) block->maxRating = movie->rating;
+
+    const char* list;
+    size_t length;
+    movieLanguageSpan(movie, &list, &length);
+    bloomAddLanguages(block, list, list + length);
+}
+
+// Function to check whether a block may hold a language with the given hash.
+// False positives are possible, false negatives are not.
+static int blockMayContainHash(const BlockSummary* block, unsigned long long hash) {
+    for (int probe = 0; probe < BLOCK_BLOOM_PROBES; probe++) {
+        unsigned int bit = bloomBit(hash, probe);
+        if (!(block->bloom[bit / 64] & (1ULL << (bit % 64)))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Function to check whether a block may hold the lowercase language `searchTerm`
+static int blockMayContainLanguage(const BlockSummary* block, const char* searchTerm) {
+    return blockMayContainHash(block, hashBytes(searchTerm, strlen(searchTerm)));
+}
+
+// Row ids of the live movies sharing one key, in file order
+typedef struct PostingList {
+    size_t* rows;
+    size_t count;
+    size_t capacity;
+} PostingList;
+
+// The movies of one year and the highest rated of them
+typedef struct YearEntry {
+    int year;
+    PostingList rows;
+    size_t bestRow;   // Highest rated live movie, the earliest on ties; valid while rows.count > 0
+} YearEntry;
+
+// The movies in one language
+typedef struct LanguageEntry {
+    char* language;   // Lowercase and trimmed; NULL marks an empty slot
+    unsigned long long hash;
+    PostingList rows;
+} LanguageEntry;
+
+// Counts of the live movies by year and by rating in tenths, as a 2D prefix
+// sum: cells[y * (tenthCount + 1) + r] counts the movies released before
+// firstYear + y and rated below (firstTenth + r) tenths, so row 0 and column 0
+// are zero and any rectangle of years x ratings is counted from four cells
+typedef struct RatingCube {
+    int firstYear;
+    int yearCount;
+    int firstTenth;
+    int tenthCount;
+    unsigned int* cells; // (yearCount + 1) x (tenthCount + 1)
+} RatingCube;
+
+// Most columns a joined CSV may add to the movies
+#define MAX_JOIN_COLUMNS 8
+
+// Secondary indexes over the live rows, kept up to date as movies are
+// inserted, updated and deleted so that queries do not need to scan
+typedef struct DatasetIndex {
+    YearEntry* years;          // Sorted by year
+    size_t yearCount;
+    size_t yearCapacity;
+    LanguageEntry* languages;  // Hash table; capacity is a power of two
+    size_t languageCount;
+    size_t languageCapacity;
+} DatasetIndex;
+
+// Size of a huge page. Explicit huge pages come in the kernel's default size,
+// which is 2 MiB on x86-64 and arm64, as are transparent ones.
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+// Function to round the size of a column region up to whole pages: huge pages
+// once it fills one, normal pages below that so that a small dataset does not
+// take a huge page for every column
+static size_t columnRegionSize(size_t bytes) {
+    size_t page = bytes >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : (size_t)sysconf(_SC_PAGESIZE);
+    if (bytes == 0) {
+        bytes = 1;
+    }
+    return (bytes + page - 1) / page * page;
+}
+
+// Function to map a zeroed region for a column of `bytes` bytes. Regions of a
+// huge page or more use explicit huge pages if enough are reserved, otherwise
+// they are aligned to huge pages and offered to transparent huge pages, and
+// where those are disabled they end up on normal pages. Scans over them then
+// need a TLB entry per 2 MiB instead of per 4 KiB. Returns NULL on failure.
+static void* allocateColumn(size_t bytes) {
+    size_t size = columnRegionSize(bytes);
+    if (size < HUGE_PAGE_SIZE) {
+        void* region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return region != MAP_FAILED ? region : NULL;
+    }
+    void* region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (region != MAP_FAILED) {
+        return region;
+    }
+    // Map a huge page more than needed and trim both ends to a huge page boundary
+    char* mapped = (char*)mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) {
+        return NULL;
+    }
+    size_t skip = (HUGE_PAGE_SIZE - (uintptr_t)mapped % HUGE_PAGE_SIZE) % HUGE_PAGE_SIZE;
+    if (skip > 0) {
+        munmap(mapped, skip);
+    }
+    munmap(mapped + skip + size, HUGE_PAGE_SIZE - skip);
+    madvise(mapped + skip, size, MADV_HUGEPAGE); // Fails harmlessly where they are disabled
+    return mapped + skip;
+}
+
+// Function to unmap a column region allocated for `bytes` bytes
+static void freeColumn(void* column, size_t bytes) {
+    if (column != NULL) {
+        munmap(column, columnRegionSize(bytes));
+    }
+}
+
+// Function to grow a column region from `oldBytes` to `newBytes` bytes,
+// keeping its contents. Returns the column, which may have moved, or NULL
+// on failure, in which case the old column is left as it was.
+static void* growColumn(void* column, size_t oldBytes, size_t newBytes) {
+    if (column != NULL && columnRegionSize(newBytes) == columnRegionSize(oldBytes)) {
+        return column;
+    }
+    void* grown = allocateColumn(newBytes);
+    if (grown != NULL && column != NULL) {
+        memcpy(grown, column, oldBytes);
+        freeColumn(column, oldBytes);
+    }
+    return grown;
+}
+
+// Movie nodes of a dataset are handed out from chunks, in row order
+typedef struct MovieChunk {
+    Movie* movies;
+    size_t capacity;
+    size_t used;
+    size_t firstRow; // Row id of movies[0]
+} MovieChunk;
+
+// Largest chunk of movie nodes; each chunk is twice the size of the last up to this
+#define MOVIE_CHUNK_LIMIT ((size_t)32 << 20)
+
+// The loaded movies: the linked list in file order plus a row table so that
+// scans can split the rows into contiguous partitions, and a summary of every
+// block of ROW_BLOCK_SIZE rows
+typedef struct Dataset {
+    Movie* head;
+    Movie* tail;      // Last node of the list, so appends do not walk the list
+    MovieChunk* movieChunks; // Where the nodes live; see newDatasetMovie
+    size_t movieChunkCount;
+    // The row table and every column are regions from allocateColumn
+    Movie** rows;     // rows[i] is the i-th movie in file order
+    int* years;       // years[i] and ratings[i] copy rows[i]'s fields as columns,
+    float* ratings;   // so filters over them read contiguous memory
+    unsigned char* deleted; // deleted[i] is set once rows[i] is deleted; the row stays as a tombstone
+    size_t deletedCount;
+    size_t count;
+    size_t capacity;
+    BlockSummary* blocks; // blocks[i] summarizes rows [i * ROW_BLOCK_SIZE, (i + 1) * ROW_BLOCK_SIZE)
+    size_t blockCount;
+    char* mappedFile; // The CSV mapped into memory in lazy mode, otherwise NULL
+    size_t mappedSize;
+    void* sharedSegment; // Read-only shared segment the movies and columns live in, or NULL
+    size_t sharedSize;
+    unsigned long generation; // Bumped whenever rows are loaded, appended, changed or deleted
+    DatasetIndex* index;      // NULL until buildDatasetIndex is called
+    RatingCube* cube;         // NULL until buildRatingCube is called
+
+    // Columns joined from a second CSV by joinDataset; NAN where a movie had no match
+    size_t joinColumnCount;
+    char joinColumnNames[MAX_JOIN_COLUMNS][32];
+    double* joinValues[MAX_JOIN_COLUMNS]; // joinValues[c][i] belongs to rows[i]
+} Dataset;
+
+// Function to append a row id to a posting list. Rows are always added in
+// file order, so the list stays sorted.
+static void postingAdd(PostingList* list, size_t row) {
+    if (list->count > 0 && list->rows[list->count - 1] == row) {
+        return; // The same language listed twice for one movie
+    }
+    if (list->count == list->capacity) {
+        size_t newCapacity = list->capacity ? list->capacity * 2 : 4;
+        size_t* newRows = (size_t*)realloc(list->rows, newCapacity * sizeof(size_t));
+        if (newRows == NULL) {
+            perror("Failed to allocate memory for a posting list");
+            exit(EXIT_FAILURE);
+        }
+        list->rows = newRows;
+        list->capacity = newCapacity;
+    }
+    list->rows[list->count++] = row;
+}
+
+// Function to remove a row id from a posting list
+static void postingRemove(PostingList* list, size_t row) {
+    size_t low = 0;
+    size_t high = list->count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (list->rows[middle] < row) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low < list->count && list->rows[low] == row) {
+        memmove(&list->rows[low], &list->rows[low + 1], (list->count - low - 1) * sizeof(size_t));
+        list->count--;
+    }
+}
+
+// Function to find the index entry for a year, creating it if `create` is set
+static YearEntry* findYearEntry(DatasetIndex* index, int year, int create) {
+    size_t low = 0;
+    size_t high = index->yearCount;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (index->years[middle].year < year) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low < index->yearCount && index->years[low].year == year) {
+        return &index->years[low];
+    }
+    if (!create) {
+        return NULL;
+    }
+    if (index->yearCount == index->yearCapacity) {
+        size_t newCapacity = index->yearCapacity ? index->yearCapacity * 2 : 64;
+        YearEntry* newYears = (YearEntry*)realloc(index->years, newCapacity * sizeof(YearEntry));
+        if (newYears == NULL) {
+            perror("Failed to allocate memory for the year index");
+            exit(EXIT_FAILURE);
+        }
+        index->years = newYears;
+        index->yearCapacity = newCapacity;
+    }
+    memmove(&index->years[low + 1], &index->years[low], (index->yearCount - low) * sizeof(YearEntry));
+    index->yearCount++;
+    memset(&index->years[low], 0, sizeof(YearEntry));
+    index->years[low].year = year;
+    return &index->years[low];
+}
+
+// Function to find the index entry for a lowercase, trimmed language, creating it if `create` is set
+static LanguageEntry* findLanguageEntry(DatasetIndex* index, const char* language, size_t length, int create) {
+    if (create && (index->languageCount + 1) * 10 > index->languageCapacity * 7) {
+        LanguageEntry* old = index->languages;
+        size_t oldCapacity = index->languageCapacity;
+        index->languageCapacity = oldCapacity ? oldCapacity * 2 : 64;
+        index->languages = (LanguageEntry*)calloc(index->languageCapacity, sizeof(LanguageEntry));
+        if (index->languages == NULL) {
+            perror("Failed to allocate memory for the language index");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < oldCapacity; i++) {
+            if (old[i].language != NULL) {
+                size_t slot = old[i].hash & (index->languageCapacity - 1);
+                while (index->languages[slot].language != NULL) {
+                    slot = (slot + 1) & (index->languageCapacity - 1);
+                }
+                index->languages[slot] = old[i];
+            }
+        }
+        free(old);
+    }
+    if (index->languageCapacity == 0) {
+        return NULL;
+    }
+
+    unsigned long long hash = hashBytes(language, length);
+    size_t slot = hash & (index->languageCapacity - 1);
+    while (index->languages[slot].language != NULL) {
+        LanguageEntry* entry = &index->languages[slot];
+        if (entry->hash == hash && strncmp(entry->language, language, length) == 0
+            && entry->language[length] == '\0') {
+            return entry;
+        }
+        slot = (slot + 1) & (index->languageCapacity - 1);
+    }
+    if (!create) {
+        return NULL;
+    }
+    LanguageEntry* entry = &index->languages[slot];
+    entry->language = (char*)malloc(length + 1);
+    if (entry->language == NULL) {
+        perror("Failed to allocate memory for the language index");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(entry->language, language, length);
+    entry->language[length] = '\0';
+    entry->hash = hash;
+    index->languageCount++;
+    return entry;
+}
+
+// Function to add or remove a movie in the posting lists of each of its languages
+static void indexLanguages(DatasetIndex* index, const Movie* movie, int add) {
+    const char* list;
+    size_t length;
+    movieLanguageSpan(movie, &list, &length);
+    const char* listEnd = list + length;
+    const char* token = list;
+    while (token < listEnd) {
+        const char* tokenEnd = (const char*)memchr(token, ';', listEnd - token);
+        if (tokenEnd == NULL) {
+            tokenEnd = listEnd;
+        }
+        const char* start = token;
+        const char* end = tokenEnd;
+        while (start < end && *start == ' ') start++;
+        while (end > start && end[-1] == ' ') end--;
+        char lowered[256];
+        size_t loweredLength = 0;
+        for (; start < end && loweredLength < sizeof(lowered); start++) {
+            lowered[loweredLength++] = tolower((unsigned char)*start);
+        }
+
+        LanguageEntry* entry = findLanguageEntry(index, lowered, loweredLength, add);
+        if (entry != NULL) {
+            if (add) {
+                postingAdd(&entry->rows, movie->rowId);
+            } else {
+                postingRemove(&entry->rows, movie->rowId);
+            }
+        }
+        token = tokenEnd + 1;
+    }
+}
+
+// Function to check whether `candidate` should replace `best` as the highest
+// rated movie of its year. Ties go to the earlier row, as in the group-by engine.
+static int betterRated(const Movie* candidate, const Movie* best) {
+    return candidate->rating > best->rating
+           || (candidate->rating == best->rating && candidate->rowId < best->rowId);
+}
+
+// Function to find the highest rated movie of a year again, after its previous
+// best was deleted or lowered. Only that year's rows are looked at.
+static void recomputeBestOfYear(const Dataset* dataset, YearEntry* entry) {
+    for (size_t i = 0; i < entry->rows.count; i++) {
+        size_t row = entry->rows.rows[i];
+        if (i == 0 || betterRated(dataset->rows[row], dataset->rows[entry->bestRow])) {
+            entry->bestRow = row;
+        }
+    }
+}
+
+// Function to add a live movie to every index
+static void indexAddMovie(Dataset* dataset, const Movie* movie) {
+    YearEntry* entry = findYearEntry(dataset->index, movie->year, 1);
+    postingAdd(&entry->rows, movie->rowId);
+    if (entry->rows.count == 1 || betterRated(movie, dataset->rows[entry->bestRow])) {
+        entry->bestRow = movie->rowId;
+    }
+    indexLanguages(dataset->index, movie, 1);
+}
+
+// Function to remove a movie from every index
+static void indexRemoveMovie(Dataset* dataset, const Movie* movie) {
+    YearEntry* entry = findYearEntry(dataset->index, movie->year, 0);
+    if (entry != NULL) {
+        postingRemove(&entry->rows, movie->rowId);
+        if (entry->bestRow == movie->rowId) {
+            recomputeBestOfYear(dataset, entry);
+        }
+    }
+    indexLanguages(dataset->index, movie, 0);
+}
+
+// Function to build the indexes over the rows loaded so far. From then on
+// every change to the dataset keeps them up to date.
+void buildDatasetIndex(Dataset* dataset) {
+    if (dataset->index != NULL) {
+        return;
+    }
+    dataset->index = (DatasetIndex*)calloc(1, sizeof(DatasetIndex));
+    if (dataset->index == NULL) {
+        perror("Failed to allocate memory for the dataset index");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < dataset->count; i++) {
+        if (!dataset->deleted[i]) {
+            indexAddMovie(dataset, dataset->rows[i]);
+        }
+    }
+}
+
+// Function to free the indexes of a dataset
+static void freeDatasetIndex(DatasetIndex* index) {
+    if (index == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < index->yearCount; i++) {
+        free(index->years[i].rows.rows);
+    }
+    for (size_t i = 0; i < index->languageCapacity; i++) {
+        free(index->languages[i].language);
+        free(index->languages[i].rows.rows);
+    }
+    free(index->years);
+    free(index->languages);
+    free(index);
+}
+
+// Largest cube, in cells, built for the year x rating counts
+#ifndef CUBE_CELL_LIMIT
+#define CUBE_CELL_LIMIT (1 << 22)
+#endif
+
+// Function to get a rating in tenths, the unit of the rating axis of the cube
+static int ratingTenths(float rating) {
+    return (int)lroundf(rating * 10.0f);
+}
+
+// Function to build the year x rating cube over the live rows. Leaves
+// dataset->cube NULL if the years and ratings span too many cells, in which
+// case counts are answered by a scan.
+void buildRatingCube(Dataset* dataset) {
+    if (dataset->cube != NULL) {
+        free(dataset->cube->cells);
+        free(dataset->cube);
+        dataset->cube = NULL;
+    }
+
+    int minYear = INT_MAX, maxYear = INT_MIN, minTenth = INT_MAX, maxTenth = INT_MIN;
+    for (size_t i = 0; i < dataset->count; i++) {
+        if (dataset->deleted[i]) {
+            continue;
+        }
+        int tenth = ratingTenths(dataset->ratings[i]);
+        if (dataset->years[i] < minYear) minYear = dataset->years[i];
+        if (dataset->years[i] > maxYear) maxYear = dataset->years[i];
+        if (tenth < minTenth) minTenth = tenth;
+        if (tenth > maxTenth) maxTenth = tenth;
+    }
+    if (minYear > maxYear) {
+        minYear = maxYear = 0; // No live rows: an empty cube that grows on the first insert
+        minTenth = maxTenth = 0;
+    }
+    long long cells = ((long long)maxYear - minYear + 2) * ((long long)maxTenth - minTenth + 2);
+    if (cells > CUBE_CELL_LIMIT) {
+        return;
+    }
+
+    RatingCube* cube = (RatingCube*)malloc(sizeof(RatingCube));
+    if (cube == NULL) {
+        perror("Failed to allocate memory for the rating cube");
+        exit(EXIT_FAILURE);
+    }
+    cube->firstYear = minYear;
+    cube->yearCount = maxYear - minYear + 1;
+    cube->firstTenth = minTenth;
+    cube->tenthCount = maxTenth - minTenth + 1;
+    cube->cells = (unsigned int*)calloc((size_t)cells, sizeof(unsigned int));
+    if (cube->cells == NULL) {
+        perror("Failed to allocate memory for the rating cube");
+        exit(EXIT_FAILURE);
+    }
+
+    // Count every movie in its cell, then turn the counts into prefix sums
+    size_t stride = cube->tenthCount + 1;
+    for (size_t i = 0; i < dataset->count; i++) {
+        if (!dataset->deleted[i]) {
+            size_t y = dataset->years[i] - cube->firstYear + 1;
+            size_t r = ratingTenths(dataset->ratings[i]) - cube->firstTenth + 1;
+            cube->cells[y * stride + r]++;
+        }
+    }
+    for (size_t y = 1; y <= (size_t)cube->yearCount; y++) {
+        for (size_t r = 1; r <= (size_t)cube->tenthCount; r++) {
+            cube->cells[y * stride + r] += cube->cells[(y - 1) * stride + r] + cube->cells[y * stride + r - 1]
+                                           - cube->cells[(y - 1) * stride + r - 1];
+        }
+    }
+    dataset->cube = cube;
+}
+
+// Function to add (delta 1) or remove (delta -1) a movie in the cube. Every
+// prefix sum covering its cell changes, which is at most the whole cube. A
+// movie outside the cube's ranges makes the cube be rebuilt to cover it.
+static void cubeUpdate(Dataset* dataset, int year, float rating, int delta) {
+    RatingCube* cube = dataset->cube;
+    int y = year - cube->firstYear + 1;
+    int r = ratingTenths(rating) - cube->firstTenth + 1;
+    if (y < 1 || y > cube->yearCount || r < 1 || r > cube->tenthCount) {
+        buildRatingCube(dataset);
+        return;
+    }
+    size_t stride = cube->tenthCount + 1;
+    for (int row = y; row <= cube->yearCount; row++) {
+        unsigned int* cells = &cube->cells[row * stride];
+        for (int column = r; column <= cube->tenthCount; column++) {
+            cells[column] += delta;
+        }
+    }
+}
+
+// Function to read the prefix sum for years up to `y` and tenths up to `r`,
+// both relative to the start of the cube and clamped to it
+static unsigned int cubePrefix(const RatingCube* cube, long long y, long long r) {
+    if (y < 0 || r < 0) {
+        return 0;
+    }
+    if (y > cube->yearCount) y = cube->yearCount;
+    if (r > cube->tenthCount) r = cube->tenthCount;
+    return cube->cells[y * (cube->tenthCount + 1) + r];
+}
+
+// Function to get a node for a movie that is about to be added to the dataset
+// with addMovieToDataset. The nodes of consecutive rows are adjacent in
+// memory, on huge pages where possible, and are freed with the dataset.
+Movie* newDatasetMovie(Dataset* dataset) {
+    MovieChunk* chunk = dataset->movieChunkCount > 0 ? &dataset->movieChunks[dataset->movieChunkCount - 1] : NULL;
+    if (chunk == NULL || chunk->used == chunk->capacity) {
+        size_t bytes = chunk != NULL ? chunk->capacity * sizeof(Movie) * 2 : ROW_BLOCK_SIZE * sizeof(Movie);
+        if (bytes > MOVIE_CHUNK_LIMIT) {
+            bytes = MOVIE_CHUNK_LIMIT;
+        }
+        MovieChunk* newChunks = (MovieChunk*)realloc(dataset->movieChunks,
+                                                     (dataset->movieChunkCount + 1) * sizeof(MovieChunk));
+        if (newChunks == NULL) {
+            perror("Failed to allocate memory for movie nodes");
+            exit(EXIT_FAILURE);
+        }
+        dataset->movieChunks = newChunks;
+        chunk = &dataset->movieChunks[dataset->movieChunkCount++];
+        chunk->movies = (Movie*)allocateColumn(bytes);
+        if (chunk->movies == NULL) {
+            perror("Failed to allocate memory for movie nodes");
+            exit(EXIT_FAILURE);
+        }
+        chunk->capacity = columnRegionSize(bytes) / sizeof(Movie);
+        chunk->used = 0;
+        chunk->firstRow = dataset->count;
+    }
+    return &chunk->movies[chunk->used++];
+}
+
+// Function to append a movie to the dataset's list and row table
+void addMovieToDataset(Dataset* dataset, Movie* newNode) {
+    addMovieToList(dataset->tail != NULL ? &dataset->tail : &dataset->head, newNode);
+    dataset->tail = newNode;
+
+    if (dataset->count == dataset->capacity) {
+        size_t newCapacity = dataset->capacity ? dataset->capacity * 2 : ROW_BLOCK_SIZE;
+        size_t oldCapacity = dataset->capacity;
+        Movie** newRows = (Movie**)growColumn(dataset->rows, oldCapacity * sizeof(Movie*),
+                                              newCapacity * sizeof(Movie*));
+        if (newRows == NULL) {
+            perror("Failed to allocate memory for the row table");
+            exit(EXIT_FAILURE);
+        }
+        dataset->rows = newRows;
+
+        int* newYears = (int*)growColumn(dataset->years, oldCapacity * sizeof(int), newCapacity * sizeof(int));
+        if (newYears == NULL) {
+            perror("Failed to allocate memory for the year column");
+            exit(EXIT_FAILURE);
+        }
+        dataset->years = newYears;
+        float* newRatings = (float*)growColumn(dataset->ratings, oldCapacity * sizeof(float),
+                                               newCapacity * sizeof(float));
+        if (newRatings == NULL) {
+            perror("Failed to allocate memory for the rating column");
+            exit(EXIT_FAILURE);
+        }
+        dataset->ratings = newRatings;
+        unsigned char* newDeleted = (unsigned char*)growColumn(dataset->deleted, oldCapacity, newCapacity);
+        if (newDeleted == NULL) {
+            perror("Failed to allocate memory for the deleted column");
+            exit(EXIT_FAILURE);
+        }
+        dataset->deleted = newDeleted;
+        for (size_t c = 0; c < dataset->joinColumnCount; c++) {
+            double* newValues = (double*)growColumn(dataset->joinValues[c], oldCapacity * sizeof(double),
+                                                    newCapacity * sizeof(double));
+            if (newValues == NULL) {
+                perror("Failed to allocate memory for a joined column");
+                exit(EXIT_FAILURE);
+            }
+            dataset->joinValues[c] = newValues;
+        }
+
+        // Blocks are sized along with the row table, which always holds whole blocks
+        BlockSummary* newBlocks = (BlockSummary*)growColumn(dataset->blocks,
+            oldCapacity / ROW_BLOCK_SIZE * sizeof(BlockSummary), newCapacity / ROW_BLOCK_SIZE * sizeof(BlockSummary));
+        if (newBlocks == NULL) {
+            perror("Failed to allocate memory for the block summaries");
+            exit(EXIT_FAILURE);
+        }
+        dataset->blocks = newBlocks;
+        dataset->capacity = newCapacity;
+    }
+    if (dataset->count % ROW_BLOCK_SIZE == 0) {
+        BlockSummary* block = &dataset->blocks[dataset->blockCount++];
+        memset(block, 0, sizeof(*block));
+        block->minYear = INT_MAX;
+        block->maxYear = INT_MIN;
+        block->minRating = FLT_MAX;
+        block->maxRating = -FLT_MAX;
+    }
+    blockSummaryAdd(&dataset->blocks[dataset->blockCount - 1], newNode);
+    newNode->rowId = dataset->count;
+    dataset->years[dataset->count] = newNode->year;
+    dataset->ratings[dataset->count] = newNode->rating;
+    dataset->deleted[dataset->count] = 0;
+    for (size_t c = 0; c < dataset->joinColumnCount; c++) {
+        dataset->joinValues[c][dataset->count] = NAN;
+    }
+    dataset->rows[dataset->count++] = newNode;
+    if (dataset->index != NULL) {
+        indexAddMovie(dataset, newNode);
+    }
+    if (dataset->cube != NULL) {
+        cubeUpdate(dataset, newNode->year, newNode->rating, 1);
+    }
+    dataset->generation++;
+}
+
+// Function to change a movie's rating, keeping the rating column, the block
+// summary and the per-year best movie up to date
+void setMovieRating(Dataset* dataset, Movie* movie, float rating) {
+    float oldRating = movie->rating;
+    movie->rating = rating;
+    dataset->ratings[movie->rowId] = rating;
+    BlockSummary* block = &dataset->blocks[movie->rowId / ROW_BLOCK_SIZE];
+    if (rating < block->minRating) block->minRating = rating;
+    if (rating > block->maxRating) block->maxRating = rating;
+
+    if (dataset->cube != NULL) {
+        cubeUpdate(dataset, movie->year, oldRating, -1);
+        cubeUpdate(dataset, movie->year, rating, 1);
+    }
+    if (dataset->index != NULL) {
+        YearEntry* entry = findYearEntry(dataset->index, movie->year, 0);
+        if (entry->bestRow == movie->rowId) {
+            if (rating < oldRating) {
+                recomputeBestOfYear(dataset, entry);
+            }
+        } else if (betterRated(movie, dataset->rows[entry->bestRow])) {
+            entry->bestRow = movie->rowId;
+        }
+    }
+    dataset->generation++;
+}
+
+// Function to delete a movie. Its row is kept as a tombstone so that row ids
+// stay stable; scans skip it and the indexes drop it. The block summary is
+// left as is, since a wider summary only costs a skipped block.
+void removeMovie(Dataset* dataset, Movie* movie) {
+    if (dataset->deleted[movie->rowId]) {
+        return;
+    }
+    dataset->deleted[movie->rowId] = 1;
+    dataset->deletedCount++;
+    if (dataset->index != NULL) {
+        indexRemoveMovie(dataset, movie);
+    }
+    if (dataset->cube != NULL) {
+        cubeUpdate(dataset, movie->year, movie->rating, -1);
+    }
+    dataset->generation++;
+}
+
+// Function to print menu
+void printMenu() {
+    printf("\n1. Show movies released in the specified year\n");
+    printf("2. Show highest rated movie for each year\n");
+    printf("3. Show the title and year of release of all movies in a specific language\n");
+    printf("4. Exit from the program\n");
+    printf("5. Show query cache statistics\n");
+    printf("6. Show rating statistics grouped by year and/or language\n");
+    printf("7. Show movies filtered by year range, language and minimum rating\n");
+    printf("8. Insert a movie\n");
+    printf("9. Update the rating of a movie\n");
+    printf("10. Delete a movie\n");
+    printf("11. Count movies by range of years and ratings\n");
+    printf("\nEnter a choice from 1 to 11: ");
+}
+
+// Function to finish a line of query output with the movie's joined columns, if any
+void printJoinedColumns(const Dataset* dataset, const Movie* movie) {
+    for (size_t c = 0; c < dataset->joinColumnCount; c++) {
+        double value = dataset->joinValues[c][movie->rowId];
+        if (isnan(value)) {
+            printf(" %s=n/a", dataset->joinColumnNames[c]);
+        } else {
+            printf(" %s=%.15g", dataset->joinColumnNames[c], value);
+        }
+    }
+    printf("\n");
+}
+
+// Sort keys that can be applied to query results before printing
+typedef enum SortKey {
+    SORT_NONE,   // Keep file order
+    SORT_YEAR,
+    SORT_RATING,
+    SORT_JOINED  // A column joined from a second CSV
+} SortKey;
+
+// Options that apply to every query, set from the command line
+typedef struct QueryOptions {
+    SortKey sortKey;
+    int descending; // Non-zero to sort from largest to smallest key
+    int workers;    // Number of threads used by full scans
+    const char* sortColumnName; // Joined column to sort by, with SORT_JOINED
+    size_t sortColumn;          // Its index among the dataset's joined columns
+} QueryOptions;
+
+// A growable array of pointers to the movies matched by a query
+typedef struct ResultSet {
+    Movie** rows;
+    size_t count;
+    size_t capacity;
+} ResultSet;
+
+// Function to add a movie to a result set, growing the array as needed
+void appendResult(ResultSet* results, Movie* movie) {
+    if (results->count == results->capacity) {
+        size_t newCapacity = results->capacity ? results->capacity * 2 : 64;
+        Movie** newRows = (Movie**)realloc(results->rows, newCapacity * sizeof(Movie*));
+        if (newRows == NULL) {
+            perror("Failed to allocate memory for query results");
+            exit(EXIT_FAILURE);
+        }
+        results->rows = newRows;
+        results->capacity = newCapacity;
+    }
+    results->rows[results->count++] = movie;
+}
+
+// Function to free the memory held by a result set
+void freeResults(ResultSet* results) {
+    free(results->rows);
+    results->rows = NULL;
+    results->count = 0;
+    results->capacity = 0;
+}
+
+// Function to compute the integer sort key of a movie.
+// Years are offset by the smallest year in the results and ratings are scaled
+// to tenths, so both keys fall in a small non-negative domain.
+static unsigned int sortKeyOf(const Movie* movie, SortKey key, int minYear) {
+    if (key == SORT_YEAR) {
+        return (unsigned int)(movie->year - minYear);
+    }
+    if (movie->rating <= 0.0f) {
+        return 0;
+    }
+    return (unsigned int)(movie->rating * 10.0f + 0.5f);
+}
+
+// Function to map a joined value to an integer key in the same order. The
+// bits of a double order like integers once the sign is handled, so every
+// distinct value keeps its own key.
+static unsigned long long joinedSortKey(double value) {
+    unsigned long long bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits & 0x8000000000000000ULL) ? ~bits : bits | 0x8000000000000000ULL;
+}
+
+// Function to sort a result set by year, rating or a joined column.
+// Uses an LSD radix sort with 8-bit digits; with the small key domains of
+// years and ratings this is a single counting-sort pass, and joined values
+// take up to eight. Every pass is stable,
+// so movies with equal keys keep their file order. Movies without a joined
+// value come last in either direction.
+void sortResults(const Dataset* dataset, ResultSet* results, const QueryOptions* options) {
+    if (options->sortKey == SORT_NONE || results->count < 2) {
+        return;
+    }
+    const double* joined = options->sortKey == SORT_JOINED ? dataset->joinValues[options->sortColumn] : NULL;
+
+    int minYear = results->rows[0]->year;
+    for (size_t i = 1; i < results->count; i++) {
+        if (results->rows[i]->year < minYear) {
+            minYear = results->rows[i]->year;
+        }
+    }
+
+    unsigned long long* keys = (unsigned long long*)malloc(results->count * sizeof(unsigned long long));
+    unsigned long long* keysTemp = (unsigned long long*)malloc(results->count * sizeof(unsigned long long));
+    Movie** rowsTemp = (Movie**)malloc(results->count * sizeof(Movie*));
+    if (keys == NULL || keysTemp == NULL || rowsTemp == NULL) {
+        perror("Failed to allocate memory for sorting results");
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned long long maxKey = 0;
+    int missing = 0;
+    for (size_t i = 0; i < results->count; i++) {
+        if (joined != NULL && isnan(joined[results->rows[i]->rowId])) {
+            keys[i] = 0;
+            missing = 1;
+            continue;
+        }
+        keys[i] = joined != NULL ? joinedSortKey(joined[results->rows[i]->rowId])
+                                 : sortKeyOf(results->rows[i], options->sortKey, minYear);
+        if (keys[i] > maxKey) {
+            maxKey = keys[i];
+        }
+    }
+    // Descending order is an ascending sort on the mirrored key, which keeps ties stable
+    if (options->descending) {
+        for (size_t i = 0; i < results->count; i++) {
+            keys[i] = maxKey - keys[i];
+        }
+    }
+    if (missing) {
+        for (size_t i = 0; i < results->count; i++) {
+            if (isnan(joined[results->rows[i]->rowId])) {
+                keys[i] = ULLONG_MAX;
+            }
+        }
+        maxKey = ULLONG_MAX;
+    }
+
+    for (unsigned int shift = 0; shift < 64 && (maxKey >> shift) != 0; shift += 8) {
+        size_t counts[257] = {0};
+        for (size_t i = 0; i < results->count; i++) {
+            counts[((keys[i] >> shift) & 0xFF) + 1]++;
+        }
+        for (int digit = 0; digit < 256; digit++) {
+            counts[digit + 1] += counts[digit];
+        }
+        for (size_t i = 0; i < results->count; i++) {
+            size_t position = counts[(keys[i] >> shift) & 0xFF]++;
+            keysTemp[position] = keys[i];
+            rowsTemp[position] = results->rows[i];
+        }
+        memcpy(keys, keysTemp, results->count * sizeof(unsigned long long));
+        memcpy(results->rows, rowsTemp, results->count * sizeof(Movie*));
+    }
+
+    free(keys);
+    free(keysTemp);
+    free(rowsTemp);
+}
+
+// Memory policy and flag for the mbind system call, from <linux/mempolicy.h>
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1 << 1)
+#endif
+
+// Most NUMA nodes and CPUs that dataset placement handles
+#define MAX_NUMA_NODES 64
+#define MAX_CPUS 1024
+#define MASK_WORDS(bits) ((bits) / (8 * sizeof(unsigned long)))
+
+// The NUMA nodes of the machine and the CPUs of each, read by placeDataset
+typedef struct NumaTopology {
+    int nodeCount; // 0 until read; 1 where there is no NUMA or it cannot be used
+    unsigned long cpus[MAX_NUMA_NODES][MASK_WORDS(MAX_CPUS)];
+} NumaTopology;
+
+static NumaTopology numaTopology;
+
+// Function to read a sysfs list such as "0-3,8-11" into a bit mask of `bits`
+// bits. Returns the highest number listed, or -1 if the file cannot be read
+// or lists a number past the mask.
+static int readListFile(const char* path, unsigned long* mask, int bits) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    char text[4096];
+    int highest = -1;
+    if (fgets(text, sizeof(text), file) != NULL) {
+        char* cursor = text;
+        while (isdigit((unsigned char)*cursor)) {
+            long first = strtol(cursor, &cursor, 10);
+            long last = first;
+            if (*cursor == '-') {
+                last = strtol(cursor + 1, &cursor, 10);
+            }
+            if (last >= bits) {
+                highest = -1;
+                break;
+            }
+            for (long n = first; n <= last; n++) {
+                mask[n / (8 * sizeof(unsigned long))] |= 1UL << (n % (8 * sizeof(unsigned long)));
+            }
+            if (last > highest) {
+                highest = (int)last;
+            }
+            cursor += *cursor == ',';
+        }
+    }
+    fclose(file);
+    return highest;
+}
+
+// Function to read the NUMA nodes and their CPUs from sysfs
+static void readNumaTopology(void) {
+    unsigned long nodes[MASK_WORDS(MAX_NUMA_NODES)] = {0};
+    int highest = readListFile("/sys/devices/system/node/online", nodes, MAX_NUMA_NODES);
+    numaTopology.nodeCount = 1;
+    for (int node = 0; node <= highest; node++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        if (readListFile(path, numaTopology.cpus[node], MAX_CPUS) < 0) {
+            return; // Offline or CPU-less nodes are not worth the trouble
+        }
+    }
+    if (highest > 0) {
+        numaTopology.nodeCount = highest + 1;
+    }
+}
+
+// Function to get the node that a row is placed on. Whole
+// blocks are split evenly between the nodes in row order.
+static int nodeOfRow(const Dataset* dataset, size_t row) {
+    if (numaTopology.nodeCount <= 1 || dataset->blockCount == 0) {
+        return 0;
+    }
+    size_t block = row / ROW_BLOCK_SIZE;
+    if (block >= dataset->blockCount) {
+        block = dataset->blockCount - 1;
+    }
+    return (int)(block * numaTopology.nodeCount / dataset->blockCount);
+}
+
+// Function to move the calling thread onto the CPUs of the node that holds
+// `row`, so that a worker scanning a partition reads memory local to it
+static void runOnNodeOfRow(const Dataset* dataset, size_t row) {
+    if (numaTopology.nodeCount <= 1 || dataset->sharedSegment != NULL) {
+        return;
+    }
+    const unsigned long* cpus = numaTopology.cpus[nodeOfRow(dataset, row)];
+    syscall(SYS_sched_setaffinity, 0, sizeof(numaTopology.cpus[0]), cpus);
+}
+
+// Function to run partition 0 of a scan on the calling thread. The worker
+// function moves the thread to its partition's node, so the caller's CPU
+// mask is put back afterwards; otherwise the main thread, and every thread it
+// starts later, would stay on the first node.
+static void runPartitionOnCaller(void* (*worker)(void*), void* partition) {
+    unsigned long saved[MASK_WORDS(MAX_CPUS)];
+    int restore = numaTopology.nodeCount > 1
+                  && syscall(SYS_sched_getaffinity, 0, sizeof(saved), saved) > 0;
+    worker(partition);
+    if (restore) {
+        syscall(SYS_sched_setaffinity, 0, sizeof(saved), saved);
+    }
+}
+
+// Function to bind the pages holding `bytes` bytes at `start` to `node`,
+// moving those already touched. Placement is best effort: errors, such as
+// mbind being unavailable, leave the pages where they are.
+static void bindToNode(const void* start, size_t bytes, size_t pageSize, int node) {
+    if (bytes == 0) {
+        return;
+    }
+    uintptr_t first = (uintptr_t)start / pageSize * pageSize;
+    uintptr_t last = ((uintptr_t)start + bytes + pageSize - 1) / pageSize * pageSize;
+    unsigned long nodes[MASK_WORDS(MAX_NUMA_NODES)] = {0};
+    nodes[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+    syscall(SYS_mbind, first, last - first, MPOL_BIND, nodes, MAX_NUMA_NODES + 1, MPOL_MF_MOVE);
+}
+
+// Function to bind the entries [begin, end) of a column region with room for
+// `capacity` entries of `size` bytes to `node`
+static void bindColumnToNode(const void* column, size_t size, size_t capacity,
+                             size_t begin, size_t end, int node) {
+    if (column == NULL || begin >= end) {
+        return;
+    }
+    size_t pageSize = columnRegionSize(capacity * size) >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE
+                      : (size_t)sysconf(_SC_PAGESIZE);
+    bindToNode((const char*)column + begin * size, (end - begin) * size, pageSize, node);
+}
+
+// Function to spread a loaded dataset over the NUMA nodes: the rows are split
+// into one contiguous range of blocks per node, and each range's movie nodes,
+// row table entries, columns and block summaries are moved to its node. Scan
+// workers then run on the node of the rows they start at (runOnNodeOfRow).
+// The loader is single-threaded, so this migrates pages that were first
+// touched on the loading thread's node rather than placing them by first
+// touch. Does nothing on a single node or for a shared dataset, whose pages
+// other processes also use.
+void placeDataset(Dataset* dataset) {
+    if (numaTopology.nodeCount == 0) {
+        readNumaTopology();
+    }
+    int nodeCount = numaTopology.nodeCount;
+    if (nodeCount <= 1 || dataset->sharedSegment != NULL || dataset->blockCount == 0) {
+        return;
+    }
+    size_t capacity = dataset->capacity;
+    for (int node = 0; node < nodeCount; node++) {
+        size_t firstBlock = (dataset->blockCount * node + nodeCount - 1) / nodeCount;
+        size_t endBlock = (dataset->blockCount * (node + 1) + nodeCount - 1) / nodeCount;
+        size_t begin = firstBlock * ROW_BLOCK_SIZE;
+        size_t end = endBlock * ROW_BLOCK_SIZE < dataset->count ? endBlock * ROW_BLOCK_SIZE : dataset->count;
+
+        for (size_t c = 0; c < dataset->movieChunkCount; c++) {
+            const MovieChunk* chunk = &dataset->movieChunks[c];
+            size_t first = begin > chunk->firstRow ? begin - chunk->firstRow : 0;
+            size_t last = end > chunk->firstRow ? end - chunk->firstRow : 0;
+            if (last > chunk->used) {
+                last = chunk->used;
+            }
+            bindColumnToNode(chunk->movies, sizeof(Movie), chunk->capacity, first, last, node);
+        }
+        bindColumnToNode(dataset->rows, sizeof(Movie*), capacity, begin, end, node);
+        bindColumnToNode(dataset->years, sizeof(int), capacity, begin, end, node);
+        bindColumnToNode(dataset->ratings, sizeof(float), capacity, begin, end, node);
+        bindColumnToNode(dataset->deleted, 1, capacity, begin, end, node);
+        for (size_t c = 0; c < dataset->joinColumnCount; c++) {
+            bindColumnToNode(dataset->joinValues[c], sizeof(double), capacity, begin, end, node);
+        }
+        bindColumnToNode(dataset->blocks, sizeof(BlockSummary), capacity / ROW_BLOCK_SIZE,
+                         firstBlock, endBlock, node);
+    }
+}
+
+// Rows ahead of the cursor whose movie node a scan prefetches, so that the
+// node is in cache by the time the predicate reads it
+#define SCAN_PREFETCH_DISTANCE 8
+
+// Predicate evaluated for every row by a scan; returns non-zero to keep the row
+typedef int (*RowPredicate)(const Movie* movie, const void* argument);
+
+// Predicate evaluated for every block before its rows; returns zero when no row
+// of the block can match, so the scan skips it
+typedef int (*BlockPredicate)(const BlockSummary* block, const void* argument);
+
+// Smallest number of rows worth handing to a separate thread
+#define MIN_ROWS_PER_WORKER 4096
+
+// The slice of the row table filtered by one scan worker
+typedef struct ScanPartition {
+    const Dataset* dataset;
+    size_t begin;
+    size_t end;
+    RowPredicate predicate;
+    BlockPredicate blockPredicate; // NULL to scan every block
+    const void* argument;
+    ResultSet results; // Matches local to this partition, in row order
+    size_t blocksSkipped;
+} ScanPartition;
+
+// Function run by each scan worker: filter one contiguous range of rows,
+// skipping the blocks whose summary rules out a match
+static void* scanPartition(void* arg) {
+    ScanPartition* partition = (ScanPartition*)arg;
+    const Dataset* dataset = partition->dataset;
+    size_t i = partition->begin;
+    runOnNodeOfRow(dataset, i);
+    while (i < partition->end) {
+        size_t blockEnd = (i / ROW_BLOCK_SIZE + 1) * ROW_BLOCK_SIZE;
+        if (blockEnd > partition->end) {
+            blockEnd = partition->end;
+        }
+        if (partition->blockPredicate != NULL
+            && !partition->blockPredicate(&dataset->blocks[i / ROW_BLOCK_SIZE], partition->argument)) {
+            partition->blocksSkipped++;
+            i = blockEnd;
+            continue;
+        }
+        for (; i < blockEnd; i++) {
+            if (i + SCAN_PREFETCH_DISTANCE < blockEnd) {
+                __builtin_prefetch(&dataset->rows[i + SCAN_PREFETCH_DISTANCE]->year);
+            }
+            Movie* movie = dataset->rows[i];
+            if (!dataset->deleted[i] && partition->predicate(movie, partition->argument)) {
+                appendResult(&partition->results, movie);
+            }
+        }
+    }
+    return NULL;
+}
+
+// Function to scan every row with the given predicate using up to `workers` threads.
+// Each worker filters a contiguous range of rows into its own buffer and the
+// buffers are concatenated in partition order, so the matches are always in
+// file order no matter how many workers run. If `blockPredicate` is given,
+// blocks it rejects are skipped; the number of skipped blocks is returned.
+size_t parallelScan(const Dataset* dataset, RowPredicate predicate, BlockPredicate blockPredicate,
+                    const void* argument, int workers, ResultSet* results) {
+    size_t maxWorkers = dataset->count / MIN_ROWS_PER_WORKER;
+    size_t workerCount = workers > 1 ? (size_t)workers : 1;
+    if (workerCount > maxWorkers) {
+        workerCount = maxWorkers > 0 ? maxWorkers : 1;
+    }
+
+    ScanPartition* partitions = (ScanPartition*)calloc(workerCount, sizeof(ScanPartition));
+    pthread_t* threads = (pthread_t*)malloc(workerCount * sizeof(pthread_t));
+    if (partitions == NULL || threads == NULL) {
+        perror("Failed to allocate memory for scan workers");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t w = 0; w < workerCount; w++) {
+        partitions[w].dataset = dataset;
+        partitions[w].begin = dataset->count * w / workerCount;
+        partitions[w].end = dataset->count * (w + 1) / workerCount;
+        partitions[w].predicate = predicate;
+        partitions[w].blockPredicate = blockPredicate;
+        partitions[w].argument = argument;
+    }
+
+    // The calling thread scans the first partition itself
+    for (size_t w = 1; w < workerCount; w++) {
+        if (pthread_create(&threads[w], NULL, scanPartition, &partitions[w]) != 0) {
+            perror("Failed to start scan worker");
+            exit(EXIT_FAILURE);
+        }
+    }
+    runPartitionOnCaller(scanPartition, &partitions[0]);
+    for (size_t w = 1; w < workerCount; w++) {
+        pthread_join(threads[w], NULL);
+    }
+
+    size_t blocksSkipped = 0;
+    for (size_t w = 0; w < workerCount; w++) {
+        for (size_t i = 0; i < partitions[w].results.count; i++) {
+            appendResult(results, partitions[w].results.rows[i]);
+        }
+        freeResults(&partitions[w].results);
+        blocksSkipped += partitions[w].blocksSkipped;
+    }
+    free(partitions);
+    free(threads);
+    return blocksSkipped;
+}
+
+// Predicate: the movie was released in the year pointed to by `argument`
+static int matchesYear(const Movie* movie, const void* argument) {
+    return movie->year == *(const int*)argument;
+}
+
+// Block predicate for matchesYear: the year lies within the block's year range
+static int blockMayMatchYear(const BlockSummary* block, const void* argument) {
+    int year = *(const int*)argument;
+    return block->minYear <= year && year <= block->maxYear;
+}
+
+// Function to check whether the ';'-separated languages in [list, listEnd)
+// include the lowercase term. Languages are compared case-insensitively after
+// trimming spaces.
+static int languageListContains(const char* list, const char* listEnd, const char* searchTerm, size_t termLength) {
+    const char* token = list;
+    while (token < listEnd) {
+        const char* tokenEnd = (const char*)memchr(token, ';', listEnd - token);
+        if (tokenEnd == NULL) {
+            tokenEnd = listEnd;
+        }
+        const char* start = token;
+        const char* end = tokenEnd;
+        while (start < end && *start == ' ') start++;
+        while (end > start && end[-1] == ' ') end--;
+
+        if ((size_t)(end - start) == termLength) {
+            size_t i = 0;
+            while (i < termLength && tolower((unsigned char)start[i]) == searchTerm[i]) {
+                i++;
+            }
+            if (i == termLength) {
+                return 1;
+            }
+        }
+        token = tokenEnd + 1;
+    }
+    return 0;
+}
+
+// Predicate: one of the movie's languages equals the lowercase term in `argument`
+static int matchesLanguage(const Movie* movie, const void* argument) {
+    const char* searchTerm = (const char*)argument;
+    const char* languages = movieLanguages(movie);
+    return languageListContains(languages, languages + strlen(languages), searchTerm, strlen(searchTerm));
+}
+
+// Block predicate for matchesLanguage: the block's Bloom filter may hold the term
+static int blockMayMatchLanguage(const BlockSummary* block, const void* argument) {
+    return blockMayContainLanguage(block, (const char*)argument);
+}
+
+// A conjunction of the filters a query can apply. Each filter is either active
+// or not, and the scan kernel specialized for the active ones is picked at run time.
+typedef struct ScanFilter {
+    int useYear;          // minYear <= year <= maxYear; equal bounds select one year
+    int minYear;
+    int maxYear;
+    int useLanguage;      // One of the languages equals `language`, which is lowercase
+    const char* language;
+    int useRating;        // minRating <= rating <= maxRating
+    float minRating;
+    float maxRating;
+    const double* joinedValues; // If set, the joined column value must be >= minJoined
+    double minJoined;
+} ScanFilter;
+
+// Where a scan kernel sends its matches
+typedef enum ScanSink {
+    SINK_COLLECT, // Append the matching movies to a ResultSet, in file order
+    SINK_COUNT    // Only count them
+} ScanSink;
+
+// A scan kernel filters rows [begin, end) and returns the number of matches
+typedef size_t (*ScanKernel)(const Dataset* dataset, const ScanFilter* filter,
+                             size_t begin, size_t end, ResultSet* results);
+
+// Defines a scan kernel specialized on which filters are active and on the
+// sink. The flags are compile-time constants, so every inactive test folds
+// away. The tombstone, year and rating tests read the column arrays and are
+// combined without branches, selecting candidate rows into a per-block
+// buffer; only the surviving candidates have their languages and joined
+// value compared. Blocks whose summary rules out a match are skipped.
+#define DEFINE_SCAN_KERNEL(name, YEAR, LANGUAGE, RATING, COLLECT)                               \
+    static size_t name(const Dataset* dataset, const ScanFilter* filter,                        \
+                       size_t begin, size_t end, ResultSet* results) {                          \
+        const int* years = dataset->years;                                                      \
+        const float* ratings = dataset->ratings;                                                \
+        const unsigned char* deleted = dataset->deleted;                                        \
+        const int minYear = filter->minYear;                                                    \
+        const int maxYear = filter->maxYear;                                                    \
+        const float minRating = filter->minRating;                                              \
+        const float maxRating = filter->maxRating;                                              \
+        const size_t termLength = LANGUAGE ? strlen(filter->language) : 0;                      \
+        unsigned int selected[ROW_BLOCK_SIZE];                                                  \
+        size_t matches = 0;                                                                     \
+        size_t blockBegin = begin;                                                              \
+        (void)years; (void)ratings; (void)minYear; (void)maxYear;                               \
+        (void)minRating; (void)maxRating; (void)termLength; (void)selected; (void)results;      \
+        while (blockBegin < end) {                                                              \
+            size_t blockEnd = (blockBegin / ROW_BLOCK_SIZE + 1) * ROW_BLOCK_SIZE;               \
+            if (blockEnd > end) {                                                               \
+                blockEnd = end;                                                                 \
+            }                                                                                   \
+            const BlockSummary* block = &dataset->blocks[blockBegin / ROW_BLOCK_SIZE];          \
+            if ((YEAR && (block->maxYear < minYear || block->minYear > maxYear))                \
+                || (RATING && (block->maxRating < minRating || block->minRating > maxRating))   \
+                || (LANGUAGE && !blockMayContainLanguage(block, filter->language))) {           \
+                blockBegin = blockEnd;                                                          \
+                continue;                                                                       \
+            }                                                                                   \
+            size_t count = 0;                                                                   \
+            for (size_t i = blockBegin; i < blockEnd; i++) {                                    \
+                int keep = !deleted[i];                                                         \
+                if (YEAR) keep &= (years[i] >= minYear) & (years[i] <= maxYear);                \
+                if (RATING) keep &= (ratings[i] >= minRating) & (ratings[i] <= maxRating);      \
+                if (LANGUAGE || COLLECT) selected[count] = (unsigned int)(i - blockBegin);      \
+                count += keep;                                                                  \
+            }                                                                                   \
+            if (LANGUAGE) {                                                                     \
+                size_t kept = 0;                                                                \
+                for (size_t j = 0; j < count; j++) {                                            \
+                    if (j + SCAN_PREFETCH_DISTANCE < count) {                                   \
+                        __builtin_prefetch(dataset->rows[blockBegin + selected[j + SCAN_PREFETCH_DISTANCE]]->languages); \
+                    }                                                                           \
+                    const char* languages = movieLanguages(dataset->rows[blockBegin + selected[j]]); \
+                    if (languageListContains(languages, languages + strlen(languages),          \
+                                             filter->language, termLength)) {                   \
+                        selected[kept++] = selected[j];                                         \
+                    }                                                                           \
+                }                                                                               \
+                count = kept;                                                                   \
+            }                                                                                   \
+            if (filter->joinedValues != NULL) {                                                 \
+                size_t kept = 0;                                                                \
+                for (size_t j = 0; j < count; j++) {                                            \
+                    if (filter->joinedValues[blockBegin + selected[j]] >= filter->minJoined) {  \
+                        selected[kept++] = selected[j];                                         \
+                    }                                                                           \
+                }                                                                               \
+                count = kept;                                                                   \
+            }                                                                                   \
+            if (COLLECT) {                                                                      \
+                for (size_t j = 0; j < count; j++) {                                            \
+                    appendResult(results, dataset->rows[blockBegin + selected[j]]);             \
+                }                                                                               \
+            }                                                                                   \
+            matches += count;                                                                   \
+            blockBegin = blockEnd;                                                              \
+        }                                                                                       \
+        return matches;                                                                         \
+    }
+
+// One kernel per combination of filters (year, language, rating) and sink
+DEFINE_SCAN_KERNEL(countKernel000, 0, 0, 0, 0)
+DEFINE_SCAN_KERNEL(countKernel001, 0, 0, 1, 0)
+DEFINE_SCAN_KERNEL(countKernel010, 0, 1, 0, 0)
+DEFINE_SCAN_KERNEL(countKernel011, 0, 1, 1, 0)
+DEFINE_SCAN_KERNEL(countKernel100, 1, 0, 0, 0)
+DEFINE_SCAN_KERNEL(countKernel101, 1, 0, 1, 0)
+DEFINE_SCAN_KERNEL(countKernel110, 1, 1, 0, 0)
+DEFINE_SCAN_KERNEL(countKernel111, 1, 1, 1, 0)
+DEFINE_SCAN_KERNEL(collectKernel000, 0, 0, 0, 1)
+DEFINE_SCAN_KERNEL(collectKernel001, 0, 0, 1, 1)
+DEFINE_SCAN_KERNEL(collectKernel010, 0, 1, 0, 1)
+DEFINE_SCAN_KERNEL(collectKernel011, 0, 1, 1, 1)
+DEFINE_SCAN_KERNEL(collectKernel100, 1, 0, 0, 1)
+DEFINE_SCAN_KERNEL(collectKernel101, 1, 0, 1, 1)
+DEFINE_SCAN_KERNEL(collectKernel110, 1, 1, 0, 1)
+DEFINE_SCAN_KERNEL(collectKernel111, 1, 1, 1, 1)
+
+// Kernels indexed by [sink][year][language][rating]
+static const ScanKernel scanKernels[2][2][2][2] = {
+    { { { collectKernel000, collectKernel001 }, { collectKernel010, collectKernel011 } },
+      { { collectKernel100, collectKernel101 }, { collectKernel110, collectKernel111 } } },
+    { { { countKernel000, countKernel001 }, { countKernel010, countKernel011 } },
+      { { countKernel100, countKernel101 }, { countKernel110, countKernel111 } } },
+};
+
+// Function to pick the kernel specialized for a filter and sink
+static ScanKernel selectScanKernel(const ScanFilter* filter, ScanSink sink) {
+    return scanKernels[sink == SINK_COUNT][filter->useYear != 0][filter->useLanguage != 0][filter->useRating != 0];
+}
+
+// The slice of the row table filtered by one kernel worker
+typedef struct KernelPartition {
+    const Dataset* dataset;
+    const ScanFilter* filter;
+    ScanKernel kernel;
+    size_t begin;
+    size_t end;
+    ResultSet results; // Matches local to this partition, in row order
+    size_t matches;
+} KernelPartition;
+
+// Function run by each kernel worker
+static void* kernelPartition(void* arg) {
+    KernelPartition* partition = (KernelPartition*)arg;
+    runOnNodeOfRow(partition->dataset, partition->begin);
+    partition->matches = partition->kernel(partition->dataset, partition->filter,
+                                           partition->begin, partition->end, &partition->results);
+    return NULL;
+}
+
+// Function to run the specialized kernel for a filter over the whole dataset
+// with up to `workers` threads. Partitions follow block boundaries. With
+// SINK_COLLECT the matches are appended to `results` in file order; the number
+// of matches is returned for either sink.
+size_t filteredScan(const Dataset* dataset, const ScanFilter* filter, ScanSink sink,
+                    int workers, ResultSet* results) {
+    // Counting kernels do not keep the candidate rows a joined value test needs
+    ScanKernel kernel = selectScanKernel(filter, filter->joinedValues != NULL ? SINK_COLLECT : sink);
+    size_t maxWorkers = dataset->count / MIN_ROWS_PER_WORKER;
+    size_t workerCount = workers > 1 ? (size_t)workers : 1;
+    if (workerCount > maxWorkers) {
+        workerCount = maxWorkers > 0 ? maxWorkers : 1;
+    }
+
+    KernelPartition* partitions = (KernelPartition*)calloc(workerCount, sizeof(KernelPartition));
+    pthread_t* threads = (pthread_t*)malloc(workerCount * sizeof(pthread_t));
+    if (partitions == NULL || threads == NULL) {
+        perror("Failed to allocate memory for scan workers");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t w = 0; w < workerCount; w++) {
+        partitions[w].dataset = dataset;
+        partitions[w].filter = filter;
+        partitions[w].kernel = kernel;
+        partitions[w].begin = dataset->blockCount * w / workerCount * ROW_BLOCK_SIZE;
+        partitions[w].end = w + 1 == workerCount ? dataset->count
+                            : dataset->blockCount * (w + 1) / workerCount * ROW_BLOCK_SIZE;
+    }
+
+    // The calling thread scans the first partition itself
+    for (size_t w = 1; w < workerCount; w++) {
+        if (pthread_create(&threads[w], NULL, kernelPartition, &partitions[w]) != 0) {
+            perror("Failed to start scan worker");
+            exit(EXIT_FAILURE);
+        }
+    }
+    runPartitionOnCaller(kernelPartition, &partitions[0]);
+    for (size_t w = 1; w < workerCount; w++) {
+        pthread_join(threads[w], NULL);
+    }
+
+    size_t matches = 0;
+    for (size_t w = 0; w < workerCount; w++) {
+        for (size_t i = 0; sink == SINK_COLLECT && i < partitions[w].results.count; i++) {
+            appendResult(results, partitions[w].results.rows[i]);
+        }
+        freeResults(&partitions[w].results);
+        matches += partitions[w].matches;
+    }
+    free(partitions);
+    free(threads);
+    return matches;
+}
+
+// A year or language query waiting for a shared scan, and its matches
+typedef struct PendingQuery {
+    int byLanguage;               // 0 for a year query
+    int year;
+    char language[256];           // Lowercase search term
+    size_t languageLength;
+    unsigned long long languageHash;
+    size_t nextWithKey;           // Next query with the same year or language, or SIZE_MAX
+    ResultSet results;            // Matches in file order once the scan has run
+} PendingQuery;
+
+// Queries answered together by one pass over the rows. A row's year, and each
+// of its languages, is looked up in a small hash table of the pending queries,
+// so the work per row does not grow with the number of queries.
+typedef struct SharedScan {
+    PendingQuery* queries;
+    size_t count;
+    size_t capacity;
+    size_t* yearSlots;            // First query of each year; SIZE_MAX when empty
+    size_t* languageSlots;        // First query of each language; SIZE_MAX when empty
+    size_t slotMask;
+} SharedScan;
+
+// Function to add a query to a shared scan: a year query, or, if `language`
+// is not NULL, a query for that language. Returns the query's index.
+size_t addPendingQuery(SharedScan* scan, int year, const char* language) {
+    if (scan->count == scan->capacity) {
+        size_t newCapacity = scan->capacity ? scan->capacity * 2 : 16;
+        PendingQuery* newQueries = (PendingQuery*)realloc(scan->queries, newCapacity * sizeof(PendingQuery));
+        if (newQueries == NULL) {
+            perror("Failed to allocate memory for pending queries");
+            exit(EXIT_FAILURE);
+        }
+        scan->queries = newQueries;
+        scan->capacity = newCapacity;
+    }
+    PendingQuery* query = &scan->queries[scan->count];
+    memset(query, 0, sizeof(*query));
+    query->year = year;
+    if (language != NULL) {
+        query->byLanguage = 1;
+        for (; language[query->languageLength] && query->languageLength < sizeof(query->language) - 1;
+             query->languageLength++) {
+            query->language[query->languageLength] = tolower((unsigned char)language[query->languageLength]);
+        }
+        query->languageHash = hashBytes(query->language, query->languageLength);
+    }
+    return scan->count++;
+}
+
+// Function to free a shared scan, its queries and their results
+void freeSharedScan(SharedScan* scan) {
+    for (size_t q = 0; q < scan->count; q++) {
+        freeResults(&scan->queries[q].results);
+    }
+    free(scan->queries);
+    free(scan->yearSlots);
+    free(scan->languageSlots);
+    memset(scan, 0, sizeof(*scan));
+}
+
+// Function to get the hash table slot a year starts probing at
+static size_t yearSlotOf(int year) {
+    return (size_t)(((unsigned long long)(unsigned int)year * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+// Function to find the first pending query for a year, or SIZE_MAX
+static size_t findYearQuery(const SharedScan* scan, int year) {
+    for (size_t slot = yearSlotOf(year) & scan->slotMask; scan->yearSlots[slot] != SIZE_MAX;
+         slot = (slot + 1) & scan->slotMask) {
+        if (scan->queries[scan->yearSlots[slot]].year == year) {
+            return scan->yearSlots[slot];
+        }
+    }
+    return SIZE_MAX;
+}
+
+// Function to find the first pending query for a language of `length` bytes
+// at `language` with the given hash, comparing case-insensitively, or SIZE_MAX
+static size_t findLanguageQuery(const SharedScan* scan, unsigned long long hash,
+                                const char* language, size_t length) {
+    for (size_t slot = hash & scan->slotMask; scan->languageSlots[slot] != SIZE_MAX;
+         slot = (slot + 1) & scan->slotMask) {
+        const PendingQuery* query = &scan->queries[scan->languageSlots[slot]];
+        if (query->languageHash == hash && query->languageLength == length
+            && strncasecmp(query->language, language, length) == 0) {
+            return scan->languageSlots[slot];
+        }
+    }
+    return SIZE_MAX;
+}
+
+// Function to build the hash tables of a shared scan. Queries with the same
+// year or language are chained behind the first one through nextWithKey.
+static void prepareSharedScan(SharedScan* scan) {
+    size_t slotCount = 16;
+    while (slotCount < scan->count * 2) {
+        slotCount *= 2;
+    }
+    free(scan->yearSlots);
+    free(scan->languageSlots);
+    scan->yearSlots = (size_t*)malloc(slotCount * sizeof(size_t));
+    scan->languageSlots = (size_t*)malloc(slotCount * sizeof(size_t));
+    if (scan->yearSlots == NULL || scan->languageSlots == NULL) {
+        perror("Failed to allocate memory for pending queries");
+        exit(EXIT_FAILURE);
+    }
+    memset(scan->yearSlots, 0xFF, slotCount * sizeof(size_t)); // Every slot SIZE_MAX
+    memset(scan->languageSlots, 0xFF, slotCount * sizeof(size_t));
+    scan->slotMask = slotCount - 1;
+
+    for (size_t q = 0; q < scan->count; q++) {
+        PendingQuery* query = &scan->queries[q];
+        query->nextWithKey = SIZE_MAX;
+        size_t first = query->byLanguage
+            ? findLanguageQuery(scan, query->languageHash, query->language, query->languageLength)
+            : findYearQuery(scan, query->year);
+        if (first != SIZE_MAX) {
+            while (scan->queries[first].nextWithKey != SIZE_MAX) {
+                first = scan->queries[first].nextWithKey;
+            }
+            scan->queries[first].nextWithKey = q;
+            continue;
+        }
+        size_t* slots = query->byLanguage ? scan->languageSlots : scan->yearSlots;
+        size_t slot = (query->byLanguage ? query->languageHash : yearSlotOf(query->year)) & scan->slotMask;
+        while (slots[slot] != SIZE_MAX) {
+            slot = (slot + 1) & scan->slotMask;
+        }
+        slots[slot] = q;
+    }
+}
+
+// The slice of the row table one shared scan worker reads
+typedef struct SharedScanPartition {
+    const Dataset* dataset;
+    const SharedScan* scan;
+    size_t begin;
+    size_t end;
+    ResultSet* results;           // One per query: its matches in this partition, in row order
+    size_t blocksSkipped;
+} SharedScanPartition;
+
+// Function to add a match to a query's results, once even if the movie lists
+// the language twice
+static void routeMatch(ResultSet* results, Movie* movie) {
+    if (results->count == 0 || results->rows[results->count - 1] != movie) {
+        appendResult(results, movie);
+    }
+}
+
+// Function run by each shared scan worker. For every block the summary is
+// checked against the pending queries; the rows are only read for the kinds
+// of query it does not rule out, and the block is skipped if it rules out all.
+static void* sharedScanPartition(void* arg) {
+    SharedScanPartition* partition = (SharedScanPartition*)arg;
+    const Dataset* dataset = partition->dataset;
+    const SharedScan* scan = partition->scan;
+    runOnNodeOfRow(dataset, partition->begin);
+    size_t i = partition->begin;
+    while (i < partition->end) {
+        size_t blockEnd = (i / ROW_BLOCK_SIZE + 1) * ROW_BLOCK_SIZE;
+        if (blockEnd > partition->end) {
+            blockEnd = partition->end;
+        }
+        const BlockSummary* block = &dataset->blocks[i / ROW_BLOCK_SIZE];
+        int checkYears = 0;
+        int checkLanguages = 0;
+        for (size_t q = 0; q < scan->count && !(checkYears && checkLanguages); q++) {
+            const PendingQuery* query = &scan->queries[q];
+            if (query->byLanguage) {
+                checkLanguages |= blockMayContainHash(block, query->languageHash);
+            } else {
+                checkYears |= query->year >= block->minYear && query->year <= block->maxYear;
+            }
+        }
+        if (!checkYears && !checkLanguages) {
+            partition->blocksSkipped++;
+            i = blockEnd;
+            continue;
+        }
+
+        for (; i < blockEnd; i++) {
+            if (checkLanguages && i + SCAN_PREFETCH_DISTANCE < blockEnd) {
+                __builtin_prefetch(dataset->rows[i + SCAN_PREFETCH_DISTANCE]->languages);
+            }
+            if (dataset->deleted[i]) {
+                continue;
+            }
+            Movie* movie = dataset->rows[i];
+            if (checkYears) {
+                for (size_t q = findYearQuery(scan, dataset->years[i]); q != SIZE_MAX;
+                     q = scan->queries[q].nextWithKey) {
+                    routeMatch(&partition->results[q], movie);
+                }
+            }
+            if (checkLanguages) {
+                const char* list;
+                size_t length;
+                movieLanguageSpan(movie, &list, &length);
+                const char* listEnd = list + length;
+                const char* token = list;
+                while (token < listEnd) {
+                    const char* tokenEnd = (const char*)memchr(token, ';', listEnd - token);
+                    if (tokenEnd == NULL) {
+                        tokenEnd = listEnd;
+                    }
+                    const char* start = token;
+                    const char* end = tokenEnd;
+                    while (start < end && *start == ' ') start++;
+                    while (end > start && end[-1] == ' ') end--;
+                    for (size_t q = findLanguageQuery(scan, languageHash(start, end), start, end - start);
+                         q != SIZE_MAX; q = scan->queries[q].nextWithKey) {
+                        routeMatch(&partition->results[q], movie);
+                    }
+                    token = tokenEnd + 1;
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+// Function to answer every pending query of a shared scan with one pass over
+// the rows, using up to `workers` threads on block-aligned partitions. Each
+// query's matches are left in its results in file order, as a separate scan
+// for it would find them. Returns the number of blocks skipped.
+size_t runSharedScan(const Dataset* dataset, SharedScan* scan, int workers) {
+    if (scan->count == 0) {
+        return 0;
+    }
+    prepareSharedScan(scan);
+    size_t maxWorkers = dataset->count / MIN_ROWS_PER_WORKER;
+    size_t workerCount = workers > 1 ? (size_t)workers : 1;
+    if (workerCount > maxWorkers) {
+        workerCount = maxWorkers > 0 ? maxWorkers : 1;
+    }
+
+    SharedScanPartition* partitions = (SharedScanPartition*)calloc(workerCount, sizeof(SharedScanPartition));
+    pthread_t* threads = (pthread_t*)malloc(workerCount * sizeof(pthread_t));
+    if (partitions == NULL || threads == NULL) {
+        perror("Failed to allocate memory for scan workers");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t w = 0; w < workerCount; w++) {
+        partitions[w].dataset = dataset;
+        partitions[w].scan = scan;
+        partitions[w].begin = dataset->blockCount * w / workerCount * ROW_BLOCK_SIZE;
+        partitions[w].end = w + 1 == workerCount ? dataset->count
+                            : dataset->blockCount * (w + 1) / workerCount * ROW_BLOCK_SIZE;
+        partitions[w].results = (ResultSet*)calloc(scan->count, sizeof(ResultSet));
+        if (partitions[w].results == NULL) {
+            perror("Failed to allocate memory for scan workers");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // The calling thread scans the first partition itself
+    for (size_t w = 1; w < workerCount; w++) {
+        if (pthread_create(&threads[w], NULL, sharedScanPartition, &partitions[w]) != 0) {
+            perror("Failed to start scan worker");
+            exit(EXIT_FAILURE);
+        }
+    }
+    runPartitionOnCaller(sharedScanPartition, &partitions[0]);
+    for (size_t w = 1; w < workerCount; w++) {
+        pthread_join(threads[w], NULL);
+    }
+
+    size_t blocksSkipped = 0;
+    for (size_t w = 0; w < workerCount; w++) {
+        for (size_t q = 0; q < scan->count; q++) {
+            const ResultSet* local = &partitions[w].results[q];
+            for (size_t i = 0; i < local->count; i++) {
+                appendResult(&scan->queries[q].results, local->rows[i]);
+            }
+            freeResults(&partitions[w].results[q]);
+        }
+        free(partitions[w].results);
+        blocksSkipped += partitions[w].blocksSkipped;
+    }
+    free(partitions);
+    free(threads);
+    return blocksSkipped;
+}
+
+// Bookkeeping charged against the cache budget for every entry, on top of its key and rows
+#define CACHE_ENTRY_OVERHEAD 64
+
+// One cached query result: the row ids of the matches, in output order,
+// encoded as zigzag varint deltas
+typedef struct CacheEntry {
+    char* key;
+    unsigned char* encoded;
+    size_t encodedLength;
+    size_t rowCount;
+    size_t bytes;                  // Memory charged against the budget
+    struct CacheEntry* newer;      // LRU list neighbours
+    struct CacheEntry* older;
+    struct CacheEntry* bucketNext; // Next entry in the same hash bucket
+} CacheEntry;
+
+// An LRU cache of query results bounded by a memory budget. Entries belong to
+// one dataset generation; when the dataset changes the whole cache is dropped.
+typedef struct QueryCache {
+    CacheEntry** buckets;
+    size_t bucketCount;
+    CacheEntry* newest;
+    CacheEntry* oldest;
+    size_t entryCount;
+    size_t bytesUsed;
+    size_t budget;                 // 0 disables the cache
+    unsigned long generation;      // Dataset generation the entries were computed from
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long invalidations;
+} QueryCache;
+
+// Function to create a query cache with a memory budget in bytes
+void initQueryCache(QueryCache* cache, size_t budget) {
+    memset(cache, 0, sizeof(*cache));
+    cache->budget = budget;
+    cache->bucketCount = 256;
+    cache->buckets = (CacheEntry**)calloc(cache->bucketCount, sizeof(CacheEntry*));
+    if (cache->buckets == NULL) {
+        perror("Failed to allocate memory for the query cache");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// FNV-1a hash of a cache key
+static size_t hashKey(const char* key) {
+    size_t hash = 14695981039346656037ULL;
+    for (; *key; key++) {
+        hash = (hash ^ (unsigned char)*key) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Function to unlink an entry from the LRU list
+static void lruUnlink(QueryCache* cache, CacheEntry* entry) {
+    if (entry->newer) entry->newer->older = entry->older; else cache->newest = entry->older;
+    if (entry->older) entry->older->newer = entry->newer; else cache->oldest = entry->newer;
+    entry->newer = entry->older = NULL;
+}
+
+// Function to make an entry the most recently used
+static void lruPushNewest(QueryCache* cache, CacheEntry* entry) {
+    entry->older = cache->newest;
+    entry->newer = NULL;
+    if (cache->newest) cache->newest->newer = entry; else cache->oldest = entry;
+    cache->newest = entry;
+}
+
+// Function to remove an entry from the cache and free it
+static void removeCacheEntry(QueryCache* cache, CacheEntry* entry) {
+    CacheEntry** link = &cache->buckets[hashKey(entry->key) % cache->bucketCount];
+    while (*link != entry) {
+        link = &(*link)->bucketNext;
+    }
+    *link = entry->bucketNext;
+    lruUnlink(cache, entry);
+    cache->bytesUsed -= entry->bytes;
+    cache->entryCount--;
+    free(entry->key);
+    free(entry->encoded);
+    free(entry);
+}
+
+// Function to drop every entry if the dataset has changed since they were cached
+static void validateCache(QueryCache* cache, const Dataset* dataset) {
+    if (cache->generation == dataset->generation) {
+        return;
+    }
+    if (cache->entryCount > 0) {
+        cache->invalidations++;
+    }
+    while (cache->newest != NULL) {
+        removeCacheEntry(cache, cache->newest);
+    }
+    cache->generation = dataset->generation;
+}
+
+// Function to free all memory held by a query cache
+void freeQueryCache(QueryCache* cache) {
+    while (cache->newest != NULL) {
+        removeCacheEntry(cache, cache->newest);
+    }
+    free(cache->buckets);
+    cache->buckets = NULL;
+}
+
+// Function to build the normalized cache key for a query and the active sort options
+void makeCacheKey(char* key, size_t keySize, const char* query, const QueryOptions* options) {
+    static const char* sortNames[] = { "none", "year", "rating" };
+    snprintf(key, keySize, "%s|sort=%s%s", query,
+             options->sortKey == SORT_JOINED ? options->sortColumnName : sortNames[options->sortKey],
+             options->sortKey != SORT_NONE && options->descending ? ",desc" : "");
+}
+
+// Function to look up a query. On a hit the cached rows are decoded into
+// `results` and 1 is returned; on a miss `results` is left untouched.
+int cacheLookup(QueryCache* cache, const Dataset* dataset, const char* key, ResultSet* results) {
+    if (cache == NULL || cache->budget == 0) {
+        return 0;
+    }
+    validateCache(cache, dataset);
+
+    CacheEntry* entry = cache->buckets[hashKey(key) % cache->bucketCount];
+    while (entry != NULL && strcmp(entry->key, key) != 0) {
+        entry = entry->bucketNext;
+    }
+    if (entry == NULL) {
+        cache->misses++;
+        return 0;
+    }
+    cache->hits++;
+    lruUnlink(cache, entry);
+    lruPushNewest(cache, entry);
+
+    const unsigned char* p = entry->encoded;
+    long long rowId = 0;
+    for (size_t i = 0; i < entry->rowCount; i++) {
+        unsigned long long zigzag = 0;
+        int shift = 0;
+        do {
+            zigzag |= (unsigned long long)(*p & 0x7F) << shift;
+            shift += 7;
+        } while (*p++ & 0x80);
+        rowId += (long long)(zigzag >> 1) ^ -(long long)(zigzag & 1);
+        appendResult(results, dataset->rows[rowId]);
+    }
+    return 1;
+}
+
+// Function to store the results of a query, evicting the least recently used
+// entries until the cache fits its budget
+void cacheStore(QueryCache* cache, const Dataset* dataset, const char* key, const ResultSet* results) {
+    if (cache == NULL || cache->budget == 0) {
+        return;
+    }
+    validateCache(cache, dataset);
+
+    // Each row id delta takes at most 10 varint bytes
+    unsigned char* encoded = (unsigned char*)malloc(results->count * 10 + 1);
+    if (encoded == NULL) {
+        perror("Failed to allocate memory for a cache entry");
+        exit(EXIT_FAILURE);
+    }
+    size_t length = 0;
+    long long previous = 0;
+    for (size_t i = 0; i < results->count; i++) {
+        long long delta = (long long)results->rows[i]->rowId - previous;
+        unsigned long long zigzag = ((unsigned long long)delta << 1) ^ (unsigned long long)(delta >> 63);
+        while (zigzag >= 0x80) {
+            encoded[length++] = (unsigned char)(zigzag | 0x80);
+            zigzag >>= 7;
+        }
+        encoded[length++] = (unsigned char)zigzag;
+        previous = (long long)results->rows[i]->rowId;
+    }
+
+    size_t bytes = length + strlen(key) + 1 + CACHE_ENTRY_OVERHEAD;
+    if (bytes > cache->budget) {
+        free(encoded);
+        return;
+    }
+    while (cache->bytesUsed + bytes > cache->budget) {
+        removeCacheEntry(cache, cache->oldest);
+        cache->evictions++;
+    }
+
+    CacheEntry* entry = (CacheEntry*)calloc(1, sizeof(CacheEntry));
+    if (entry == NULL || (entry->key = strdup(key)) == NULL) {
+        perror("Failed to allocate memory for a cache entry");
+        exit(EXIT_FAILURE);
+    }
+    entry->encoded = (unsigned char*)realloc(encoded, length + 1);
+    entry->encodedLength = length;
+    entry->rowCount = results->count;
+    entry->bytes = bytes;
+    size_t bucket = hashKey(key) % cache->bucketCount;
+    entry->bucketNext = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    lruPushNewest(cache, entry);
+    cache->entryCount++;
+    cache->bytesUsed += bytes;
+}
+
+// 5. Show query cache statistics
+void showCacheStatistics(const QueryCache* cache) {
+    unsigned long lookups = cache->hits + cache->misses;
+    printf("Query cache: %zu entries, %zu of %zu bytes used\n",
+           cache->entryCount, cache->bytesUsed, cache->budget);
+    printf("Hits %lu, misses %lu (hit rate %.1f%%), evictions %lu, invalidations %lu\n",
+           cache->hits, cache->misses, lookups ? 100.0 * cache->hits / lookups : 0.0,
+           cache->evictions, cache->invalidations);
+}
+
+static int compareYearsByFirstRow(const void* a, const void* b) {
+    size_t left = (*(const YearEntry* const*)a)->rows.rows[0];
+    size_t right = (*(const YearEntry* const*)b)->rows.rows[0];
+    return (left > right) - (left < right);
+}
+
+// Function to collect the movies released in a year, in file order, from the
+// year index if it has been built and with a scan otherwise
+static void collectMoviesByYear(const Dataset* dataset, int year, int workers, ResultSet* results) {
+    if (dataset->index != NULL) {
+        YearEntry* entry = findYearEntry(dataset->index, year, 0);
+        for (size_t i = 0; entry != NULL && i < entry->rows.count; i++) {
+            appendResult(results, dataset->rows[entry->rows.rows[i]]);
+        }
+        return;
+    }
+    ScanFilter filter = { .useYear = 1, .minYear = year, .maxYear = year };
+    filteredScan(dataset, &filter, SINK_COLLECT, workers, results);
+}
+
+// Function to collect the movies in a lowercase language, in file order, from
+// the language postings if they have been built and with a scan otherwise
+static void collectMoviesByLanguage(const Dataset* dataset, const char* language, int workers, ResultSet* results) {
+    if (dataset->index != NULL) {
+        LanguageEntry* entry = findLanguageEntry(dataset->index, language, strlen(language), 0);
+        for (size_t i = 0; entry != NULL && i < entry->rows.count; i++) {
+            appendResult(results, dataset->rows[entry->rows.rows[i]]);
+        }
+        return;
+    }
+    ScanFilter filter = { .useLanguage = 1, .language = language };
+    filteredScan(dataset, &filter, SINK_COLLECT, workers, results);
+}
+
+// Function to read an optional "column minimum" line naming one of the
+// dataset's joined columns. Sets `values` to the column (NULL when the line is
+// empty) and returns 0, after printing an error, if the line names no joined
+// column or has no value. Only asked when a join is loaded.
+static int readJoinedMinimum(const Dataset* dataset, char column[32], const double** values, double* minimum) {
+    char line[128];
+    *values = NULL;
+    column[0] = '\0';
+    printf("Enter a joined column and its minimum value (leave empty for none): ");
+    if (fgets(line, sizeof(line), stdin) == NULL) {
+        line[0] = '\0';
+    }
+    if (sscanf(line, "%31s %lf", column, minimum) == 2) {
+        for (size_t c = 0; c < dataset->joinColumnCount; c++) {
+            if (strcasecmp(dataset->joinColumnNames[c], column) == 0) {
+                *values = dataset->joinValues[c];
+            }
+        }
+    }
+    if (*values == NULL && strspn(line, " \n") != strlen(line)) {
+        printf("Unknown joined column or missing value: %s", line);
+        return 0;
+    }
+    return 1;
+}
+
+// Function to drop the movies whose joined value is below `minimum` or missing
+static void keepJoinedMinimum(ResultSet* results, const double* values, double minimum) {
+    size_t kept = 0;
+    for (size_t i = 0; i < results->count; i++) {
+        if (values[results->rows[i]->rowId] >= minimum) {
+            results->rows[kept++] = results->rows[i];
+        }
+    }
+    results->count = kept;
+}
+
+// 1. Show movies released in the specified year
+void showMoviesByYear(const Dataset* dataset, const QueryOptions* options, QueryCache* cache) {
+    int searchYear;
+    printf("Enter the year for which you want to see movies: ");
+    if (scanf("%d", &searchYear) != 1) {
+        printf("Invalid input. Please enter a number.\n");
+        while (getchar() != '\n'); // Clear input buffer
+        return;
+    }
+
+    char column[32] = "";
+    const double* joinedValues = NULL;
+    double minJoined = 0.0;
+    if (dataset->joinColumnCount > 0) {
+        getchar(); // Consume the newline character left by previous input
+        if (!readJoinedMinimum(dataset, column, &joinedValues, &minJoined)) {
+            return;
+        }
+    }
+
+    char query[128];
+    char key[256];
+    if (joinedValues != NULL) {
+        snprintf(query, sizeof(query), "year=%d,%s>=%a", searchYear, column, minJoined);
+    } else {
+        snprintf(query, sizeof(query), "year=%d", searchYear);
+    }
+    makeCacheKey(key, sizeof(key), query, options);
+
+    ResultSet results = {0};
+    if (!cacheLookup(cache, dataset, key, &results)) {
+        collectMoviesByYear(dataset, searchYear, options->workers, &results);
+        if (joinedValues != NULL) {
+            keepJoinedMinimum(&results, joinedValues, minJoined);
+        }
+        sortResults(dataset, &results, options);
+        cacheStore(cache, dataset, key, &results);
+    }
+    if (results.count == 0) {
+        printf("No data about movies released in the year %d\n", searchYear);
+    }
+
+    for (size_t i = 0; i < results.count; i++) {
+        printf("%s", movieTitle(results.rows[i]));
+        printJoinedColumns(dataset, results.rows[i]);
+    }
+    freeResults(&results);
+}
+
+// What the rows are grouped by
+typedef enum GroupKey {
+    GROUP_BY_YEAR,
+    GROUP_BY_LANGUAGE,
+    GROUP_BY_YEAR_LANGUAGE
+} GroupKey;
+
+// Running aggregates of the ratings in one group
+typedef struct Aggregate {
+    unsigned long count;     // 0 for an unused dense slot
+    double sum;
+    float min;
+    float max;
+    size_t maxRow;           // First row (in file order) with the maximum rating
+    size_t firstRow;         // First row of the group, used to order the output
+    unsigned int firstToken; // Position of the group's language within that row
+} Aggregate;
+
+// A group in the hash table: its key and aggregates
+typedef struct GroupEntry {
+    int used;
+    int year;
+    char language[64];       // Lowercase language, empty when not grouped by language
+    char label[64];          // Spelling of the language in the group's first row
+    unsigned long long hash;
+    Aggregate aggregate;
+} GroupEntry;
+
+// Largest year range that is aggregated into a dense array instead of the hash table
+#define DENSE_GROUP_LIMIT 4096
+
+// Aggregates for every group. Year groups use a dense array indexed by
+// year - minYear when the year range is small; everything else uses an
+// open-addressing hash table with linear probing.
+typedef struct GroupTable {
+    GroupKey by;
+    int minYear;
+    size_t denseCount;       // Slots in `dense`, 0 when the hash table is used
+    Aggregate* dense;
+    GroupEntry* entries;     // Hash table; capacity is a power of two
+    size_t capacity;
+    size_t groupCount;
+} GroupTable;
+
+// Function to set up an empty group table. Years outside [minYear, maxYear]
+// are not expected when the dense array is used.
+void initGroupTable(GroupTable* table, GroupKey by, int minYear, int maxYear) {
+    memset(table, 0, sizeof(*table));
+    table->by = by;
+    table->minYear = minYear;
+    if (by == GROUP_BY_YEAR && maxYear >= minYear && maxYear - minYear < DENSE_GROUP_LIMIT) {
+        table->denseCount = (size_t)(maxYear - minYear) + 1;
+        table->dense = (Aggregate*)calloc(table->denseCount, sizeof(Aggregate));
+        if (table->dense == NULL) {
+            perror("Failed to allocate memory for group aggregates");
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+    table->capacity = 64;
+    table->entries = (GroupEntry*)calloc(table->capacity, sizeof(GroupEntry));
+    if (table->entries == NULL) {
+        perror("Failed to allocate memory for group aggregates");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Function to free a group table
+void freeGroupTable(GroupTable* table) {
+    free(table->dense);
+    free(table->entries);
+    memset(table, 0, sizeof(*table));
+}
+
+// Function to fold one rating into an aggregate
+static void aggregateAdd(Aggregate* aggregate, float rating, size_t row) {
+    if (aggregate->count == 0) {
+        aggregate->min = aggregate->max = rating;
+        aggregate->maxRow = aggregate->firstRow = row;
+    } else {
+        if (rating < aggregate->min) {
+            aggregate->min = rating;
+        }
+        if (rating > aggregate->max) {
+            aggregate->max = rating;
+            aggregate->maxRow = row;
+        }
+    }
+    aggregate->count++;
+    aggregate->sum += rating;
+}
+
+// Function to merge a partial aggregate into another one. Ties on the maximum
+// go to the earlier row, so the result does not depend on how rows were split.
+static void aggregateMerge(Aggregate* into, const Aggregate* from) {
+    if (from->count == 0) {
+        return;
+    }
+    if (into->count == 0) {
+        *into = *from;
+        return;
+    }
+    if (from->min < into->min) {
+        into->min = from->min;
+    }
+    if (from->max > into->max || (from->max == into->max && from->maxRow < into->maxRow)) {
+        into->max = from->max;
+        into->maxRow = from->maxRow;
+    }
+    if (from->firstRow < into->firstRow) {
+        into->firstRow = from->firstRow;
+        into->firstToken = from->firstToken;
+    }
+    into->count += from->count;
+    into->sum += from->sum;
+}
+
+// Function to find or insert the hash table entry for a key
+static GroupEntry* findGroup(GroupTable* table, int year, const char* language, const char* label,
+                             unsigned long long hash) {
+    if ((table->groupCount + 1) * 10 > table->capacity * 7) {
+        // Grow to keep the load factor under 70%
+        GroupEntry* old = table->entries;
+        size_t oldCapacity = table->capacity;
+        table->capacity *= 2;
+        table->entries = (GroupEntry*)calloc(table->capacity, sizeof(GroupEntry));
+        if (table->entries == NULL) {
+            perror("Failed to allocate memory for group aggregates");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < oldCapacity; i++) {
+            if (old[i].used) {
+                size_t slot = old[i].hash & (table->capacity - 1);
+                while (table->entries[slot].used) {
+                    slot = (slot + 1) & (table->capacity - 1);
+                }
+                table->entries[slot] = old[i];
+            }
+        }
+        free(old);
+    }
+
+    size_t slot = hash & (table->capacity - 1);
+    while (table->entries[slot].used) {
+        GroupEntry* entry = &table->entries[slot];
+        if (entry->hash == hash && entry->year == year && strcmp(entry->language, language) == 0) {
+            return entry;
+        }
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+    GroupEntry* entry = &table->entries[slot];
+    entry->used = 1;
+    entry->year = year;
+    entry->hash = hash;
+    strcpy(entry->language, language);
+    strcpy(entry->label, label);
+    table->groupCount++;
+    return entry;
+}
+
+// Function to get the aggregate for a key, creating the group if needed
+static Aggregate* groupAggregate(GroupTable* table, int year, const char* language, const char* label) {
+    if (table->dense != NULL) {
+        Aggregate* aggregate = &table->dense[year - table->minYear];
+        if (aggregate->count == 0) {
+            table->groupCount++;
+        }
+        return aggregate;
+    }
+    unsigned long long hash = hashBytes(language, strlen(language)) ^ ((unsigned long long)(unsigned int)year * 0x9E3779B97F4A7C15ULL);
+    return &findGroup(table, year, language, label, hash)->aggregate;
+}
+
+// Function to add one movie to a group table
+static void groupAddMovie(GroupTable* table, const Movie* movie) {
+    if (table->by == GROUP_BY_YEAR) {
+        aggregateAdd(groupAggregate(table, movie->year, "", ""), movie->rating, movie->rowId);
+        return;
+    }
+
+    // One group per language of the movie
+    const char* token = movieLanguages(movie);
+    unsigned int position = 0;
+    while (*token != '\0') {
+        const char* tokenEnd = strchr(token, ';');
+        if (tokenEnd == NULL) {
+            tokenEnd = token + strlen(token);
+        }
+        const char* start = token;
+        const char* end = tokenEnd;
+        while (start < end && *start == ' ') start++;
+        while (end > start && end[-1] == ' ') end--;
+
+        if (end > start) {
+            char label[64];
+            char language[64];
+            size_t length = end - start;
+            if (length >= sizeof(label)) {
+                length = sizeof(label) - 1;
+            }
+            for (size_t i = 0; i < length; i++) {
+                label[i] = start[i];
+                language[i] = tolower((unsigned char)start[i]);
+            }
+            label[length] = language[length] = '\0';
+            int year = table->by == GROUP_BY_YEAR_LANGUAGE ? movie->year : 0;
+            Aggregate* aggregate = groupAggregate(table, year, language, label);
+            aggregateAdd(aggregate, movie->rating, movie->rowId);
+            if (aggregate->count == 1) {
+                aggregate->firstToken = position;
+            }
+            position++;
+        }
+        token = *tokenEnd == ';' ? tokenEnd + 1 : tokenEnd;
+    }
+}
+
+// Function to merge a partial group table into another with the same layout
+static void mergeGroupTables(GroupTable* into, const GroupTable* from) {
+    if (from->dense != NULL) {
+        for (size_t i = 0; i < from->denseCount; i++) {
+            if (from->dense[i].count > 0) {
+                Aggregate* aggregate = groupAggregate(into, from->minYear + (int)i, "", "");
+                aggregateMerge(aggregate, &from->dense[i]);
+            }
+        }
+        return;
+    }
+    for (size_t i = 0; i < from->capacity; i++) {
+        const GroupEntry* entry = &from->entries[i];
+        if (entry->used) {
+            aggregateMerge(&findGroup(into, entry->year, entry->language, entry->label, entry->hash)->aggregate,
+                           &entry->aggregate);
+        }
+    }
+}
+
+// The slice of the row table aggregated by one worker
+typedef struct GroupPartition {
+    const Dataset* dataset;
+    size_t begin;
+    size_t end;
+    GroupTable table;        // Partial aggregates for this slice
+} GroupPartition;
+
+// Function run by each aggregation worker
+static void* groupPartition(void* arg) {
+    GroupPartition* partition = (GroupPartition*)arg;
+    runOnNodeOfRow(partition->dataset, partition->begin);
+    for (size_t i = partition->begin; i < partition->end; i++) {
+        if (i + SCAN_PREFETCH_DISTANCE < partition->end) {
+            __builtin_prefetch(&partition->dataset->rows[i + SCAN_PREFETCH_DISTANCE]->year);
+        }
+        if (!partition->dataset->deleted[i]) {
+            groupAddMovie(&partition->table, partition->dataset->rows[i]);
+        }
+    }
+    return NULL;
+}
+
+// Function to aggregate every row into `table` using up to `workers` threads.
+// Each worker builds partial aggregates for a contiguous range of rows and the
+// partials are merged afterwards.
+void groupBy(const Dataset* dataset, GroupKey by, int workers, GroupTable* table) {
+    int minYear = 0;
+    int maxYear = -1;
+    for (size_t i = 0; i < dataset->count; i++) {
+        int year = dataset->rows[i]->year;
+        if (i == 0 || year < minYear) minYear = year;
+        if (i == 0 || year > maxYear) maxYear = year;
+    }
+    initGroupTable(table, by, minYear, maxYear);
+
+    size_t maxWorkers = dataset->count / MIN_ROWS_PER_WORKER;
+    size_t workerCount = workers > 1 ? (size_t)workers : 1;
+    if (workerCount > maxWorkers) {
+        workerCount = maxWorkers > 0 ? maxWorkers : 1;
+    }
+    GroupPartition* partitions = (GroupPartition*)calloc(workerCount, sizeof(GroupPartition));
+    pthread_t* threads = (pthread_t*)malloc(workerCount * sizeof(pthread_t));
+    if (partitions == NULL || threads == NULL) {
+        perror("Failed to allocate memory for aggregation workers");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t w = 0; w < workerCount; w++) {
+        partitions[w].dataset = dataset;
+        partitions[w].begin = dataset->count * w / workerCount;
+        partitions[w].end = dataset->count * (w + 1) / workerCount;
+        initGroupTable(&partitions[w].table, by, minYear, maxYear);
+    }
+    for (size_t w = 1; w < workerCount; w++) {
+        if (pthread_create(&threads[w], NULL, groupPartition, &partitions[w]) != 0) {
+            perror("Failed to start aggregation worker");
+            exit(EXIT_FAILURE);
+        }
+    }
+    runPartitionOnCaller(groupPartition, &partitions[0]);
+    for (size_t w = 1; w < workerCount; w++) {
+        pthread_join(threads[w], NULL);
+    }
+    for (size_t w = 0; w < workerCount; w++) {
+        mergeGroupTables(table, &partitions[w].table);
+        freeGroupTable(&partitions[w].table);
+    }
+    free(partitions);
+    free(threads);
+}
+
+// One group pulled out of a table for printing
+typedef struct GroupRow {
+    int year;
+    const char* label;
+    const Aggregate* aggregate;
+} GroupRow;
+
+static int compareGroupRows(const void* a, const void* b) {
+    const Aggregate* left = ((const GroupRow*)a)->aggregate;
+    const Aggregate* right = ((const GroupRow*)b)->aggregate;
+    if (left->firstRow != right->firstRow) {
+        return (left->firstRow > right->firstRow) - (left->firstRow < right->firstRow);
+    }
+    return (left->firstToken > right->firstToken) - (left->firstToken < right->firstToken);
+}
+
+// Function to list the groups of a table in order of their first row.
+// The returned array points into the table and must be freed by the caller.
+GroupRow* listGroups(const GroupTable* table, size_t* count) {
+    GroupRow* rows = (GroupRow*)malloc((table->groupCount + 1) * sizeof(GroupRow));
+    if (rows == NULL) {
+        perror("Failed to allocate memory for groups");
+        exit(EXIT_FAILURE);
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < table->denseCount; i++) {
+        if (table->dense[i].count > 0) {
+            rows[n].year = table->minYear + (int)i;
+            rows[n].label = "";
+            rows[n++].aggregate = &table->dense[i];
+        }
+    }
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->entries[i].used) {
+            rows[n].year = table->entries[i].year;
+            rows[n].label = table->entries[i].label;
+            rows[n++].aggregate = &table->entries[i].aggregate;
+        }
+    }
+    qsort(rows, n, sizeof(GroupRow), compareGroupRows);
+    *count = n;
+    return rows;
+}
+
+// Function to collect the highest rated movie of each year, in order of each year's first appearance
+static void collectHighestRatedPerYear(const Dataset* dataset, int workers, ResultSet* results) {
+    if (dataset->index != NULL) {
+        // Years are listed in order of their first movie, as the group-by engine does
+        const DatasetIndex* index = dataset->index;
+        const YearEntry** years = (const YearEntry**)malloc((index->yearCount + 1) * sizeof(YearEntry*));
+        if (years == NULL) {
+            perror("Failed to allocate memory for the year list");
+            exit(EXIT_FAILURE);
+        }
+        size_t count = 0;
+        for (size_t i = 0; i < index->yearCount; i++) {
+            if (index->years[i].rows.count > 0) {
+                years[count++] = &index->years[i];
+            }
+        }
+        qsort(years, count, sizeof(YearEntry*), compareYearsByFirstRow);
+        for (size_t i = 0; i < count; i++) {
+            appendResult(results, dataset->rows[years[i]->bestRow]);
+        }
+        free(years);
+        return;
+    }
+    GroupTable table;
+    groupBy(dataset, GROUP_BY_YEAR, workers, &table);
+    size_t count;
+    GroupRow* groups = listGroups(&table, &count);
+    for (size_t i = 0; i < count; i++) {
+        appendResult(results, dataset->rows[groups[i].aggregate->maxRow]);
+    }
+    free(groups);
+    freeGroupTable(&table);
+}
+
+// 2. Show highest rated movie for each year
+void showHighestRatedMoviePerYear(const Dataset* dataset, const QueryOptions* options, QueryCache* cache) {
+    char key[128];
+    makeCacheKey(key, sizeof(key), "best-per-year", options);
+
+    ResultSet results = {0};
+    if (!cacheLookup(cache, dataset, key, &results)) {
+        collectHighestRatedPerYear(dataset, options->workers, &results);
+        sortResults(dataset, &results, options);
+        cacheStore(cache, dataset, key, &results);
+    }
+    for (size_t i = 0; i < results.count; i++) {
+        printf("%d %.1f %s", results.rows[i]->year, results.rows[i]->rating, movieTitle(results.rows[i]));
+        printJoinedColumns(dataset, results.rows[i]);
+    }
+    freeResults(&results);
+}
+
+// 6. Show rating statistics grouped by year, language, or both
+void showGroupedStatistics(const Dataset* dataset, const QueryOptions* options) {
+    int grouping;
+    printf("Group by 1) year, 2) language or 3) year and language: ");
+    if (scanf("%d", &grouping) != 1 || grouping < 1 || grouping > 3) {
+        printf("Invalid input. Please enter 1, 2 or 3.\n");
+        while (getchar() != '\n'); // Clear input buffer
+        return;
+    }
+    GroupKey by = grouping == 1 ? GROUP_BY_YEAR : grouping == 2 ? GROUP_BY_LANGUAGE : GROUP_BY_YEAR_LANGUAGE;
+
+    GroupTable table;
+    groupBy(dataset, by, options->workers, &table);
+    size_t count;
+    GroupRow* groups = listGroups(&table, &count);
+    printf("%s%sMovies Average  Min  Max\n", by != GROUP_BY_LANGUAGE ? "Year " : "",
+           by != GROUP_BY_YEAR ? "Language             " : "");
+    for (size_t i = 0; i < count; i++) {
+        const Aggregate* aggregate = groups[i].aggregate;
+        if (by != GROUP_BY_LANGUAGE) {
+            printf("%4d ", groups[i].year);
+        }
+        if (by != GROUP_BY_YEAR) {
+            printf("%-20s ", groups[i].label);
+        }
+        printf("%6lu %7.2f %4.1f %4.1f\n", aggregate->count, aggregate->sum / aggregate->count,
+               aggregate->min, aggregate->max);
+    }
+    free(groups);
+    freeGroupTable(&table);
+}
+
+// 3. Show the title and year of release of all movies in a specific language
+void showMoviesByLanguage(const Dataset* dataset, const QueryOptions* options, QueryCache* cache) {
+    char searchTerm[256];
+    char orginalTerm[256];
+    printf("Enter the language for which you want to see movies: ");
+    getchar(); // Consume the newline character left by previous input
+    fgets(orginalTerm, sizeof(orginalTerm), stdin);
+    orginalTerm[strcspn(orginalTerm, "\n")] = '\0'; // Remove trailing newline
+
+    // Convert search term to lowercase for case-insensitive comparison
+    int termLength = 0;
+    for (; orginalTerm[termLength]; termLength++) {
+        searchTerm[termLength] = tolower(orginalTerm[termLength]);
+    }
+    searchTerm[termLength] = '\0';
+
+    char column[32] = "";
+    const double* joinedValues = NULL;
+    double minJoined = 0.0;
+    if (dataset->joinColumnCount > 0 && !readJoinedMinimum(dataset, column, &joinedValues, &minJoined)) {
+        return;
+    }
+
+    char query[400];
+    char key[500];
+    if (joinedValues != NULL) {
+        snprintf(query, sizeof(query), "language=%s,%s>=%a", searchTerm, column, minJoined);
+    } else {
+        snprintf(query, sizeof(query), "language=%s", searchTerm);
+    }
+    makeCacheKey(key, sizeof(key), query, options);
+
+    ResultSet results = {0};
+    if (!cacheLookup(cache, dataset, key, &results)) {
+        collectMoviesByLanguage(dataset, searchTerm, options->workers, &results);
+        if (joinedValues != NULL) {
+            keepJoinedMinimum(&results, joinedValues, minJoined);
+        }
+        sortResults(dataset, &results, options);
+        cacheStore(cache, dataset, key, &results);
+    }
+    if (results.count == 0) {
+        printf("No data about movies released in %s\n", orginalTerm);
+    }
+
+    for (size_t i = 0; i < results.count; i++) {
+        printf("%d %s", results.rows[i]->year, movieTitle(results.rows[i]));
+        printJoinedColumns(dataset, results.rows[i]);
+    }
+    freeResults(&results);
+}
+
+// 7. Show movies matching any combination of a year range, a language and a minimum rating
+void showFilteredMovies(const Dataset* dataset, const QueryOptions* options, QueryCache* cache) {
+    ScanFilter filter = {0};
+    printf("Enter the first and last year (0 0 for any year): ");
+    if (scanf("%d %d", &filter.minYear, &filter.maxYear) != 2) {
+        printf("Invalid input. Please enter two numbers.\n");
+        while (getchar() != '\n'); // Clear input buffer
+        return;
+    }
+    filter.useYear = filter.minYear != 0 || filter.maxYear != 0;
+
+    char searchTerm[256];
+    char orginalTerm[256];
+    printf("Enter the language (leave empty for any language): ");
+    getchar(); // Consume the newline character left by previous input
+    if (fgets(orginalTerm, sizeof(orginalTerm), stdin) == NULL) {
+        orginalTerm[0] = '\0';
+    }
+    orginalTerm[strcspn(orginalTerm, "\n")] = '\0'; // Remove trailing newline
+    int termLength = 0;
+    for (; orginalTerm[termLength]; termLength++) {
+        searchTerm[termLength] = tolower(orginalTerm[termLength]);
+    }
+    searchTerm[termLength] = '\0';
+    filter.useLanguage = termLength > 0;
+    filter.language = searchTerm;
+
+    printf("Enter the minimum rating (0 for any rating): ");
+    if (scanf("%f", &filter.minRating) != 1) {
+        printf("Invalid input. Please enter a number.\n");
+        while (getchar() != '\n'); // Clear input buffer
+        return;
+    }
+    filter.useRating = filter.minRating > 0;
+    filter.maxRating = FLT_MAX;
+
+    char column[32] = "";
+    if (dataset->joinColumnCount > 0) {
+        getchar(); // Consume the newline character left by previous input
+        if (!readJoinedMinimum(dataset, column, &filter.joinedValues, &filter.minJoined)) {
+            return;
+        }
+    }
+
+    char query[400];
+    char key[500];
+    // Numbers are keyed exactly (%a), so minimums that round alike do not share an entry
+    snprintf(query, sizeof(query), "filter=%d-%d,%s,%a,%s>=%a", filter.useYear ? filter.minYear : 0,
+             filter.useYear ? filter.maxYear : 0, searchTerm, filter.useRating ? filter.minRating : 0.0f,
+             filter.joinedValues != NULL ? column : "", filter.joinedValues != NULL ? filter.minJoined : 0.0);
+    makeCacheKey(key, sizeof(key), query, options);
+
+    ResultSet results = {0};
+    if (!cacheLookup(cache, dataset, key, &results)) {
+        filteredScan(dataset, &filter, SINK_COLLECT, options->workers, &results);
+        sortResults(dataset, &results, options);
+        cacheStore(cache, dataset, key, &results);
+    }
+    if (results.count == 0) {
+        printf("No movies match the filter\n");
+    }
+
+    for (size_t i = 0; i < results.count; i++) {
+        printf("%d %.1f %s", results.rows[i]->year, results.rows[i]->rating, movieTitle(results.rows[i]));
+        printJoinedColumns(dataset, results.rows[i]);
+    }
+    freeResults(&results);
+}
+
+// Function to read a line of input into `buffer` without the trailing newline
+static void readLine(char* buffer, size_t size) {
+    if (fgets(buffer, (int)size, stdin) == NULL) {
+        buffer[0] = '\0';
+    }
+    buffer[strcspn(buffer, "\n")] = '\0';
+}
+
+// Function to find a live movie by year and exact title
+Movie* findMovie(const Dataset* dataset, int year, const char* title) {
+    if (dataset->index != NULL) {
+        YearEntry* entry = findYearEntry(dataset->index, year, 0);
+        for (size_t i = 0; entry != NULL && i < entry->rows.count; i++) {
+            Movie* movie = dataset->rows[entry->rows.rows[i]];
+            if (strcmp(movieTitle(movie), title) == 0) {
+                return movie;
+            }
+        }
+        return NULL;
+    }
+    for (size_t i = 0; i < dataset->count; i++) {
+        Movie* movie = dataset->rows[i];
+        if (!dataset->deleted[i] && movie->year == year && strcmp(movieTitle(movie), title) == 0) {
+            return movie;
+        }
+    }
+    return NULL;
+}
+
+// Function to ask for a movie's year and title and look it up
+static Movie* promptForMovie(const Dataset* dataset) {
+    int year;
+    char title[256];
+    printf("Enter the year of the movie: ");
+    if (scanf("%d", &year) != 1) {
+        printf("Invalid input. Please enter a number.\n");
+        while (getchar() != '\n'); // Clear input buffer
+        return NULL;
+    }
+    printf("Enter the title of the movie: ");
+    getchar(); // Consume the newline character left by previous input
+    readLine(title, sizeof(title));
+
+    Movie* movie = findMovie(dataset, year, title);
+    if (movie == NULL) {
+        printf("No movie titled %s was released in %d\n", title, year);
+    }
+    return movie;
+}
+
+// 8. Insert a movie
+void insertMovie(Dataset* dataset) {
+    if (dataset->sharedSegment != NULL) {
+        printf("The shared dataset is read-only.\n");
+        return;
+    }
+    char title[256];
+    char languages[256];
+    int year;
+    float rating;
+    printf("Enter the title of the movie: ");
+    getchar(); // Consume the newline character left by previous input
+    readLine(title, sizeof(title));
+    if (title[0] == '\0') {
+        printf("The title cannot be empty.\n");
+        return;
+    }
+    printf("Enter the year of release: ");
+    if (scanf("%d", &year) != 1 || year <= 0) {
+        printf("Invalid input. Please enter a year.\n");
+        while (getchar() != '\n'); // Clear input buffer
+        return;
+    }
+    printf("Enter the languages separated by ';': ");
+    getchar(); // Consume the newline character left by previous input
+    readLine(languages, sizeof(languages));
+    printf("Enter the rating: ");
+    if (scanf("%f", &rating) != 1) {
+        printf("Invalid input. Please enter a number.\n");
+        while (getchar() != '\n'); // Clear input buffer
+        return;
+    }
+
+    Movie* newMovie = newDatasetMovie(dataset);
+    initMovieNode(newMovie, title, year, languages, rating);
+    addMovieToDataset(dataset, newMovie);
+    printf("Inserted %s (%d)\n", title, year);
+}
+
+// 9. Update the rating of a movie
+void updateMovieRating(Dataset* dataset) {
+    if (dataset->sharedSegment != NULL) {
+        printf("The shared dataset is read-only.\n");
+        return;
+    }
+    Movie* movie = promptForMovie(dataset);
+    if (movie == NULL) {
+        return;
+    }
+    float rating;
+    printf("Enter the new rating: ");
+    if (scanf("%f", &rating) != 1) {
+        printf("Invalid input. Please enter a number.\n");
+        while (getchar() != '\n'); // Clear input buffer
+        return;
+    }
+    setMovieRating(dataset, movie, rating);
+    printf("Updated the rating of %s (%d) to %.1f\n", movieTitle(movie), movie->year, rating);
+}
+
+// 10. Delete a movie
+void deleteMovie(Dataset* dataset) {
+    if (dataset->sharedSegment != NULL) {
+        printf("The shared dataset is read-only.\n");
+        return;
+    }
+    Movie* movie = promptForMovie(dataset);
+    if (movie == NULL) {
+        return;
+    }
+    removeMovie(dataset, movie);
+    printf("Deleted %s (%d)\n", movieTitle(movie), movie->year);
+}
+
+// Function to count the live movies released from firstYear to lastYear with
+// a rating from lowTenth to highTenth tenths, all inclusive. With the cube this
+// takes four lookups; without it the counting scan kernel runs.
+size_t countMoviesInRange(const Dataset* dataset, int firstYear, int lastYear,
+                          int lowTenth, int highTenth, int workers) {
+    if (firstYear > lastYear || lowTenth > highTenth) {
+        return 0;
+    }
+    const RatingCube* cube = dataset->cube;
+    if (cube != NULL) {
+        long long y1 = (long long)firstYear - cube->firstYear;
+        long long y2 = (long long)lastYear - cube->firstYear + 1;
+        long long r1 = (long long)lowTenth - cube->firstTenth;
+        long long r2 = (long long)highTenth - cube->firstTenth + 1;
+        return (size_t)cubePrefix(cube, y2, r2) - cubePrefix(cube, y1, r2)
+               - cubePrefix(cube, y2, r1) + cubePrefix(cube, y1, r1);
+    }
+    // Half a tenth of slack on both sides matches the rounding into tenths
+    ScanFilter filter = { .useYear = 1, .minYear = firstYear, .maxYear = lastYear,
+                          .useRating = 1, .minRating = (lowTenth - 0.5f) / 10.0f,
+                          .maxRating = (highTenth + 0.5f) / 10.0f };
+    return filteredScan(dataset, &filter, SINK_COUNT, workers, NULL);
+}
+
+// 11. Count the movies in a range of years with a rating in a given range
+void showMovieCount(const Dataset* dataset, const QueryOptions* options) {
+    int firstYear, lastYear;
+    float lowRating, highRating;
+    printf("Enter the first and last year: ");
+    if (scanf("%d %d", &firstYear, &lastYear) != 2) {
+        printf("Invalid input. Please enter two numbers.\n");
+        while (getchar() != '\n'); // Clear input buffer
+        return;
+    }
+    printf("Enter the lowest and highest rating: ");
+    if (scanf("%f %f", &lowRating, &highRating) != 2) {
+        printf("Invalid input. Please enter two numbers.\n");
+        while (getchar() != '\n'); // Clear input buffer
+        return;
+    }
+    size_t count = countMoviesInRange(dataset, firstYear, lastYear, ratingTenths(lowRating),
+                                      ratingTenths(highRating), options->workers);
+    printf("%zu movies released from %d to %d are rated from %.1f to %.1f\n",
+           count, firstYear, lastYear, lowRating, highRating);
+}
+
+// Function to free everything owned by a dataset
+void freeDataset(Dataset* dataset) {
+    size_t capacity = dataset->capacity;
+    for (size_t i = 0; i < dataset->movieChunkCount; i++) {
+        freeColumn(dataset->movieChunks[i].movies, dataset->movieChunks[i].capacity * sizeof(Movie));
+    }
+    free(dataset->movieChunks);
+    freeColumn(dataset->rows, capacity * sizeof(Movie*));
+    if (dataset->sharedSegment != NULL) {
+        // The movie records, columns, blocks and cube cells all live in the segment
+        munmap(dataset->sharedSegment, dataset->sharedSize);
+    } else {
+        freeColumn(dataset->years, capacity * sizeof(int));
+        freeColumn(dataset->ratings, capacity * sizeof(float));
+        freeColumn(dataset->deleted, capacity);
+        freeColumn(dataset->blocks, capacity / ROW_BLOCK_SIZE * sizeof(BlockSummary));
+        if (dataset->cube != NULL) {
+            free(dataset->cube->cells);
+        }
+    }
+    for (size_t c = 0; c < dataset->joinColumnCount; c++) {
+        freeColumn(dataset->joinValues[c], capacity * sizeof(double));
+    }
+    freeDatasetIndex(dataset->index);
+    free(dataset->cube);
+    if (dataset->mappedFile != NULL) {
+        munmap(dataset->mappedFile, dataset->mappedSize);
+    }
+    unsigned long generation = dataset->generation;
+    memset(dataset, 0, sizeof(*dataset));
+    dataset->generation = generation + 1;
+}
+
+// Movie fields that a CSV column can be mapped to
+typedef enum ColumnField {
+    FIELD_SKIP,      // Column no query needs; its value is never parsed
+    FIELD_TITLE,
+    FIELD_YEAR,
+    FIELD_LANGUAGES,
+    FIELD_RATING
+} ColumnField;
+
+// How the tokenizer finds where a column's value ends
+typedef enum ColumnShape {
+    SHAPE_TOKEN,     // A single delimiter-free token
+    SHAPE_TEXT,      // Free text that may contain the delimiter (the title)
+    SHAPE_LIST       // A bracketed "[a;b;c]" block
+} ColumnShape;
+
+#define MAX_COLUMNS 16
+
+// One step of the tokenizer generated from the header
+typedef struct ParseStep {
+    ColumnField field;
+    ColumnShape shape;
+} ParseStep;
+
+// The schema read from the header line, compiled into a table of parse steps.
+// Steps stop at the last column a query needs, so trailing columns such as
+// "Value" are never tokenized.
+typedef struct Schema {
+    char delimiter;             // ',' for comma-separated files, ' ' for space-separated
+    int columnCount;            // Columns named in the header
+    int stepCount;              // Columns actually tokenized
+    ParseStep steps[MAX_COLUMNS];
+} Schema;
+
+// The fields of one row, as spans into the line they were parsed from
+typedef struct ParsedRow {
+    const char* title;
+    size_t titleLength;
+    int year;
+    const char* languages;      // Includes the brackets when present
+    size_t languagesLength;
+    float rating;
+} ParsedRow;
+
+// Function to map a header column name to a movie field (case-insensitive)
+static ColumnField fieldForColumn(const char* name, size_t length) {
+    static const struct {
+        const char* name;
+        ColumnField field;
+    } names[] = {
+        { "title", FIELD_TITLE },
+        { "year", FIELD_YEAR },
+        { "languages", FIELD_LANGUAGES },
+        { "language", FIELD_LANGUAGES },
+        { "rating", FIELD_RATING },
+        { "rating value", FIELD_RATING },
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strlen(names[i].name) == length && strncasecmp(names[i].name, name, length) == 0) {
+            return names[i].field;
+        }
+    }
+    return FIELD_SKIP;
+}
+
+// Function to read the header line into a schema.
+// Returns NULL on success or a description of what is wrong with the header.
+const char* parseHeader(const char* header, Schema* schema) {
+    memset(schema, 0, sizeof(*schema));
+    schema->delimiter = strchr(header, ',') != NULL ? ',' : ' ';
+
+    int seen[FIELD_RATING + 1] = {0};
+    int lastNeeded = -1;
+    const char* p = header;
+    while (*p != '\0' && *p != '\n' && *p != '\r') {
+        while (*p == ' ' || *p == '\t') p++;
+        const char* end = p;
+        while (*end != '\0' && *end != '\n' && *end != '\r' && *end != schema->delimiter) end++;
+        const char* nameEnd = end;
+        while (nameEnd > p && (nameEnd[-1] == ' ' || nameEnd[-1] == '\t')) nameEnd--;
+
+        if (nameEnd > p) {
+            if (schema->columnCount == MAX_COLUMNS) {
+                return "Too many columns in header";
+            }
+            ColumnField field = fieldForColumn(p, nameEnd - p);
+            if (field != FIELD_SKIP) {
+                if (seen[field]++) {
+                    return "Duplicate column in header";
+                }
+                lastNeeded = schema->columnCount;
+            }
+            ParseStep* step = &schema->steps[schema->columnCount++];
+            step->field = field;
+            step->shape = field == FIELD_TITLE ? SHAPE_TEXT
+                        : field == FIELD_LANGUAGES ? SHAPE_LIST : SHAPE_TOKEN;
+        }
+        p = *end == schema->delimiter ? end + 1 : end;
+    }
+
+    if (!seen[FIELD_TITLE] || !seen[FIELD_YEAR] || !seen[FIELD_LANGUAGES] || !seen[FIELD_RATING]) {
+        return "Header must name Title, Year, Languages and Rating columns";
+    }
+    schema->stepCount = lastNeeded + 1;
+    return NULL;
+}
+
+// Function to skip the spaces before a value
+static const char* skipSpaces(const char* p) {
+    while (*p == ' ' || *p == '\t') p++;
+    return p;
+}
+
+// Function to find the end of the value starting at p for the given step.
+// Returns NULL if a bracketed list is not closed.
+static const char* valueEnd(const char* p, ColumnShape shape, char delimiter) {
+    if (shape == SHAPE_LIST && *p == '[') {
+        const char* close = strchr(p, ']');
+        return close != NULL ? close + 1 : NULL;
+    }
+    if (delimiter == ' ') {
+        while (*p != '\0' && *p != ' ' && *p != '\t') p++;
+    } else {
+        while (*p != '\0' && *p != delimiter) p++;
+    }
+    return p;
+}
+
+// Function to check whether [start, end) is a plausible year (all digits)
+static int isYearToken(const char* start, const char* end) {
+    if (start == end) {
+        return 0;
+    }
+    for (const char* p = start; p < end; p++) {
+        if (!isdigit((unsigned char)*p)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Function to find where the free-text column starting at `text` ends in a
+// space-separated line. The title may contain spaces and digits, so it is
+// anchored on what follows it: the `tokensBefore` plain tokens that precede the
+// first bracketed list, or, without a list, the last `tokensAfter` tokens of
+// the line. Returns NULL and sets *error when no valid anchor exists.
+static const char* findTextEnd(const char* text, const Schema* schema, int textStep, const char** error) {
+    int listStep = -1;
+    for (int s = textStep + 1; s < schema->stepCount; s++) {
+        if (schema->steps[s].shape == SHAPE_LIST) {
+            listStep = s;
+            break;
+        }
+    }
+
+    if (listStep < 0) {
+        // Right-anchored: walk back one token per remaining step
+        const char* end = text + strlen(text);
+        while (end > text && (end[-1] == ' ' || end[-1] == '\t')) end--;
+        for (int s = schema->stepCount - 1; s > textStep; s--) {
+            while (end > text && end[-1] != ' ' && end[-1] != '\t') end--;
+            while (end > text && (end[-1] == ' ' || end[-1] == '\t')) end--;
+        }
+        if (end == text) {
+            *error = "Could not find year";
+        }
+        return end > text ? end : NULL;
+    }
+
+    int tokensBefore = listStep - textStep - 1;
+    int sawList = 0;
+    // Try every '[' that starts a token until the tokens before it fit the schema
+    for (const char* bracket = strchr(text, '['); bracket != NULL; bracket = strchr(bracket + 1, '[')) {
+        if (bracket > text && bracket[-1] != ' ' && bracket[-1] != '\t') {
+            continue;
+        }
+        sawList = 1;
+        const char* end = bracket;
+        int valid = 1;
+        for (int s = listStep - 1; s > textStep && valid; s--) {
+            while (end > text && (end[-1] == ' ' || end[-1] == '\t')) end--;
+            const char* tokenEnd = end;
+            while (end > text && end[-1] != ' ' && end[-1] != '\t') end--;
+            if (end == tokenEnd || (schema->steps[s].field == FIELD_YEAR && !isYearToken(end, tokenEnd))) {
+                valid = 0;
+            }
+        }
+        while (end > text && (end[-1] == ' ' || end[-1] == '\t')) end--;
+        if (valid && (end > text || tokensBefore == 0)) {
+            return end;
+        }
+    }
+    *error = sawList ? "Could not find year" : "Could not find languages block";
+    return NULL;
+}
+
+// Function to tokenize one data line by running the schema's parse steps.
+// Returns NULL on success or the reason the line was rejected.
+const char* parseRow(const Schema* schema, const char* line, ParsedRow* row) {
+    memset(row, 0, sizeof(*row));
+    const char* p = line;
+
+    for (int s = 0; s < schema->stepCount; s++) {
+        const ParseStep* step = &schema->steps[s];
+        const char* error = NULL;
+        p = skipSpaces(p);
+
+        const char* end;
+        if (step->shape == SHAPE_TEXT && schema->delimiter == ' ') {
+            end = findTextEnd(p, schema, s, &error);
+            if (end == NULL) {
+                return error;
+            }
+        } else {
+            end = valueEnd(p, step->shape, schema->delimiter);
+            if (end == NULL) {
+                return "Malformed languages block";
+            }
+        }
+
+        const char* valueStop = end;
+        while (valueStop > p && (valueStop[-1] == ' ' || valueStop[-1] == '\t')) valueStop--;
+        switch (step->field) {
+            case FIELD_TITLE:
+                row->title = p;
+                row->titleLength = valueStop - p;
+                break;
+            case FIELD_YEAR:
+                if (!isYearToken(p, valueStop)) {
+                    return "Could not find year";
+                }
+                row->year = atoi(p);
+                break;
+            case FIELD_LANGUAGES:
+                if (schema->delimiter == ' ' && *p != '[') {
+                    return "Could not find languages block";
+                }
+                row->languages = p;
+                row->languagesLength = valueStop - p;
+                break;
+            case FIELD_RATING:
+                row->rating = atof(p);
+                break;
+            case FIELD_SKIP:
+                break;
+        }
+
+        p = end;
+        if (schema->delimiter != ' ') {
+            // Step over the comma that ends this value
+            while (*p == ' ' || *p == '\t') p++;
+            if (*p == schema->delimiter) p++;
+        }
+    }
+    return NULL;
+}
+
+// Size of the stdio buffer of the quarantine file
+#define QUARANTINE_BUFFER_SIZE (1 << 20)
+
+// Most rejected lines printed to the console in any one second
+#define CONSOLE_REJECTS_PER_SECOND 10
+
+// Distinct reasons counted separately in the rejection summary
+#define MAX_REJECT_REASONS 16
+
+// How many lines were rejected for one reason
+typedef struct RejectCount {
+    const char* reason;
+    unsigned long count;
+} RejectCount;
+
+// Where rejected lines go: an optional quarantine file, written through a
+// large buffer, and a rate-limited console, with counts per reason for the
+// summary printed at the end of the load
+typedef struct Quarantine {
+    FILE* file;             // NULL when rejected lines are not kept
+    char* buffer;           // stdio buffer of the file
+    const char* path;
+    RejectCount reasons[MAX_REJECT_REASONS];
+    size_t reasonCount;
+    unsigned long rejected;
+    unsigned long suppressed; // Console messages left out by the rate limit
+    time_t window;            // Second the console messages are counted in
+    int windowMessages;
+    int writeFailed;          // Set once a write to the file has failed
+} Quarantine;
+
+// Function to open a quarantine file for the rejected lines of a load.
+// Returns 0 on success and -1 after printing an error.
+int openQuarantine(Quarantine* quarantine, const char* path) {
+    quarantine->file = fopen(path, "w");
+    if (quarantine->file == NULL) {
+        perror("Error opening quarantine file");
+        return -1;
+    }
+    quarantine->buffer = (char*)malloc(QUARANTINE_BUFFER_SIZE);
+    if (quarantine->buffer == NULL) {
+        perror("Failed to allocate memory for the quarantine buffer");
+        exit(EXIT_FAILURE);
+    }
+    setvbuf(quarantine->file, quarantine->buffer, _IOFBF, QUARANTINE_BUFFER_SIZE);
+    quarantine->path = path;
+    return 0;
+}
+
+// Function to report the first failed write to the quarantine file
+static void quarantineWriteFailed(Quarantine* quarantine) {
+    if (!quarantine->writeFailed) {
+        quarantine->writeFailed = 1;
+        fprintf(stderr, "Error writing quarantine file %s: %s\n", quarantine->path, strerror(errno));
+    }
+}
+
+// Function to close the quarantine file, writing out what is still buffered
+void closeQuarantine(Quarantine* quarantine) {
+    if (quarantine->file != NULL) {
+        if (ferror(quarantine->file) || fclose(quarantine->file) != 0) {
+            quarantineWriteFailed(quarantine);
+        }
+        quarantine->file = NULL;
+    }
+    free(quarantine->buffer);
+    quarantine->buffer = NULL;
+}
+
+// Function to record a rejected line: count it under its reason, write it to
+// the quarantine file as "line number<TAB>reason<TAB>line", and print it to
+// the console unless this second's messages are used up
+void quarantineLine(Quarantine* quarantine, size_t lineNumber, const char* reason, const char* line) {
+    quarantine->rejected++;
+    size_t i = 0;
+    while (i < quarantine->reasonCount && strcmp(quarantine->reasons[i].reason, reason) != 0) {
+        i++;
+    }
+    if (i == quarantine->reasonCount) {
+        if (i == MAX_REJECT_REASONS) {
+            i--; // The last slot collects every further reason
+            quarantine->reasons[i].reason = "Other errors";
+        } else {
+            quarantine->reasons[i].reason = reason;
+            quarantine->reasonCount++;
+        }
+    }
+    quarantine->reasons[i].count++;
+
+    if (quarantine->file != NULL && fprintf(quarantine->file, "%zu\t%s\t%s\n", lineNumber, reason, line) < 0) {
+        quarantineWriteFailed(quarantine);
+    }
+
+    time_t now = time(NULL);
+    if (now != quarantine->window) {
+        quarantine->window = now;
+        quarantine->windowMessages = 0;
+    }
+    if (quarantine->windowMessages < CONSOLE_REJECTS_PER_SECOND) {
+        quarantine->windowMessages++;
+        fprintf(stderr, "Error: %s in line: %s\n", reason, line);
+    } else {
+        quarantine->suppressed++;
+    }
+}
+
+// Function to print the counts of rejected lines per reason once a load ends
+void printRejectSummary(Quarantine* quarantine) {
+    if (quarantine->rejected == 0) {
+        return;
+    }
+    if (quarantine->file != NULL && (fflush(quarantine->file) != 0 || ferror(quarantine->file))) {
+        quarantineWriteFailed(quarantine);
+    }
+    fprintf(stderr, "Rejected %lu lines", quarantine->rejected);
+    if (quarantine->suppressed > 0) {
+        fprintf(stderr, " (%lu not shown above)", quarantine->suppressed);
+    }
+    fprintf(stderr, ":\n");
+    for (size_t i = 0; i < quarantine->reasonCount; i++) {
+        fprintf(stderr, "  %s: %lu\n", quarantine->reasons[i].reason, quarantine->reasons[i].count);
+    }
+    if (quarantine->file != NULL && quarantine->writeFailed) {
+        fprintf(stderr, "Not every rejected line could be written to %s\n", quarantine->path);
+    } else if (quarantine->file != NULL) {
+        fprintf(stderr, "Rejected lines were written to %s\n", quarantine->path);
+    }
+}
+
+// Callback that receives every valid row instead of the dataset, for modes
+// that process rows straight off the parser without building the movie list
+typedef void (*RowSink)(void* context, const ParsedRow* row);
+
+// State shared by every loader while it feeds lines into the dataset
+typedef struct LoadState {
+    Schema schema;
+    int haveHeader;         // Set once the header line has been compiled
+    int failed;             // Set if the header is invalid; later lines are ignored
+    const char* lazySource; // Mapped file in lazy mode, otherwise NULL
+    Dataset* dataset;
+    RowSink rowSink;        // When set, rows go here and the dataset is not touched
+    void* sinkContext;
+    int movieCount;
+    size_t lineNumber;      // Of the line being loaded, counting the header as line 1
+    Quarantine* quarantine; // Receives rejected lines; NULL prints every one of them
+} LoadState;
+
+// Function to reject a data line for `reason`
+static void rejectLine(LoadState* state, const char* line, const char* reason) {
+    if (state->quarantine == NULL) {
+        fprintf(stderr, "Error: %s in line: %s\n", reason, line);
+        return;
+    }
+    quarantineLine(state->quarantine, state->lineNumber, reason, line);
+}
+
+// Function to parse one data line and add the movie to the dataset, or pass
+// it to the load's row sink. In lazy mode `line` is a copy of the bytes at
+// `lineOffset` in the mapped file and only the year and rating are decoded;
+// otherwise every field is copied.
+// Returns 1 if a movie was added, 0 if the line was rejected.
+int ingestLine(LoadState* state, const char* line, size_t lineOffset) {
+    const char* lazySource = state->lazySource;
+    ParsedRow row;
+    const char* error = parseRow(&state->schema, line, &row);
+    if (error != NULL) {
+        rejectLine(state, line, error);
+        return 0;
+    }
+
+    char title[256];
+    char languages[256];
+    if (row.titleLength >= sizeof(title)) { // Prevent buffer overflow
+        rejectLine(state, line, "Title too long");
+        return 0;
+    }
+    if (row.languagesLength >= sizeof(languages)) { // Prevent buffer overflow
+        rejectLine(state, line, "Languages string too long");
+        return 0;
+    }
+    if (state->rowSink != NULL) {
+        state->rowSink(state->sinkContext, &row);
+        return 1;
+    }
+
+    Movie* newMovie = newDatasetMovie(state->dataset);
+    if (lazySource != NULL) {
+        initLazyMovieNode(newMovie, lazySource,
+                          lineOffset + (row.title - line), row.titleLength,
+                          lineOffset + (row.languages - line), row.languagesLength,
+                          row.year, row.rating);
+    } else {
+        memcpy(title, row.title, row.titleLength);
+        title[row.titleLength] = '\0';
+        memcpy(languages, row.languages, row.languagesLength);
+        languages[row.languagesLength] = '\0';
+        initMovieNode(newMovie, title, row.year, languages, row.rating);
+    }
+    addMovieToDataset(state->dataset, newMovie);
+    return 1;
+}
+
+// Function to load one line of `length` bytes found at `offset` in the input.
+// The first line is the header; every later line is a movie.
+void loadLine(LoadState* state, const char* bytes, size_t length, size_t offset) {
+    char line[1024]; // Assuming max line length
+    if (state->failed) {
+        return;
+    }
+    if (length > sizeof(line) - 1) {
+        length = sizeof(line) - 1;
+    }
+    memcpy(line, bytes, length);
+    line[length] = '\0';
+    line[strcspn(line, "\r")] = '\0';
+    state->lineNumber++;
+
+    if (!state->haveHeader) {
+        const char* headerError = parseHeader(line, &state->schema);
+        if (headerError != NULL) {
+            fprintf(stderr, "Error: %s: %s\n", headerError, line);
+            state->failed = 1;
+            return;
+        }
+        state->haveHeader = 1;
+    } else {
+        state->movieCount += ingestLine(state, line, offset);
+    }
+}
+
+// Function to check that a load saw a valid header, and summarize the lines
+// it rejected. Returns the number of movies loaded, or -1 on error.
+int finishLoad(const LoadState* state) {
+    if (state->quarantine != NULL) {
+        printRejectSummary(state->quarantine);
+    }
+    if (state->failed) {
+        return -1;
+    }
+    if (!state->haveHeader) {
+        fprintf(stderr, "Error reading header or empty file.\n");
+        return -1;
+    }
+    return state->movieCount;
+}
+
+// Compression formats recognised by their magic bytes
+typedef enum CompressionFormat {
+    COMPRESSION_NONE,
+    COMPRESSION_GZIP,
+    COMPRESSION_ZSTD
+} CompressionFormat;
+
+// Function to detect a compressed stream from its first bytes
+CompressionFormat detectCompression(const char* data, size_t length) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    if (length >= 2 && bytes[0] == 0x1F && bytes[1] == 0x8B) {
+        return COMPRESSION_GZIP;
+    }
+    if (length >= 4 && bytes[0] == 0x28 && bytes[1] == 0xB5 && bytes[2] == 0x2F && bytes[3] == 0xFD) {
+        return COMPRESSION_ZSTD;
+    }
+    return COMPRESSION_NONE;
+}
+
+// Function to load a CSV in lazy mode: the file is mapped and stays mapped for
+// the life of the dataset so titles and languages can be decoded from it later.
+// Returns the number of movies loaded, or -1 on error.
+int loadMappedFile(const char* path, Dataset* dataset, Quarantine* quarantine) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening file");
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        perror("Error reading file size");
+        close(fd);
+        return -1;
+    }
+    if (info.st_size == 0) {
+        fprintf(stderr, "Error reading header or empty file.\n");
+        close(fd);
+        return -1;
+    }
+    char* data = (char*)mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("Error mapping file");
+        return -1;
+    }
+    if (detectCompression(data, info.st_size) != COMPRESSION_NONE) {
+        fprintf(stderr, "Error: --lazy needs an uncompressed file\n");
+        munmap(data, info.st_size);
+        return -1;
+    }
+    madvise(data, info.st_size, MADV_SEQUENTIAL);
+    dataset->mappedFile = data;
+    dataset->mappedSize = info.st_size;
+
+    LoadState state = {0};
+    state.lazySource = data;
+    state.dataset = dataset;
+    state.quarantine = quarantine;
+
+    const char* end = data + info.st_size;
+    const char* cursor = data;
+    while (cursor < end) {
+        const char* newline = (const char*)memchr(cursor, '\n', end - cursor);
+        const char* lineEnd = newline != NULL ? newline : end;
+        loadLine(&state, cursor, lineEnd - cursor, cursor - data);
+        cursor = newline != NULL ? newline + 1 : end;
+    }
+    return finishLoad(&state);
+}
+
+// Size and number of the read buffers kept in flight by the ingest pipeline
+#ifndef PIPELINE_BLOCK_SIZE
+#define PIPELINE_BLOCK_SIZE (1 << 20)
+#endif
+#define PIPELINE_DEPTH 4
+
+// A producer of consecutive blocks of the input file. The parser takes one
+// filled block at a time with next() and hands it back with release() so the
+// buffer can be refilled while later blocks are parsed.
+typedef struct BlockSource {
+    // Returns 1 and the block's bytes, 0 at end of input, or -1 on a read error
+    int (*next)(struct BlockSource* source, const char** data, size_t* length);
+    void (*release)(struct BlockSource* source);
+    void (*close)(struct BlockSource* source);
+} BlockSource;
+
+// A bounded ring of buffers filled by a producer thread and drained in order by the parser
+typedef struct BlockQueue {
+    char* buffers[PIPELINE_DEPTH];
+    size_t lengths[PIPELINE_DEPTH];
+    size_t produced;         // Blocks published so far
+    size_t consumed;         // Blocks released by the parser so far
+    int finished;            // Producer reached the end of input
+    int error;               // errno of a failed read, or 0
+    int cancelled;           // Parser stopped early; the producer should exit
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} BlockQueue;
+
+// Function to allocate the buffers of a block queue
+static void initBlockQueue(BlockQueue* queue) {
+    memset(queue, 0, sizeof(*queue));
+    for (int i = 0; i < PIPELINE_DEPTH; i++) {
+        queue->buffers[i] = (char*)malloc(PIPELINE_BLOCK_SIZE);
+        if (queue->buffers[i] == NULL) {
+            perror("Failed to allocate memory for read buffers");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+}
+
+// Function to free the buffers of a block queue
+static void destroyBlockQueue(BlockQueue* queue) {
+    for (int i = 0; i < PIPELINE_DEPTH; i++) {
+        free(queue->buffers[i]);
+    }
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->changed);
+}
+
+// Producer side: wait for an empty buffer. Returns NULL if the parser cancelled.
+static char* queueAcquireEmpty(BlockQueue* queue) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->produced - queue->consumed == PIPELINE_DEPTH && !queue->cancelled) {
+        pthread_cond_wait(&queue->changed, &queue->lock);
+    }
+    char* buffer = queue->cancelled ? NULL : queue->buffers[queue->produced % PIPELINE_DEPTH];
+    pthread_mutex_unlock(&queue->lock);
+    return buffer;
+}
+
+// Producer side: publish the buffer returned by queueAcquireEmpty holding `length` bytes
+static void queuePublish(BlockQueue* queue, size_t length) {
+    pthread_mutex_lock(&queue->lock);
+    queue->lengths[queue->produced % PIPELINE_DEPTH] = length;
+    queue->produced++;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// Producer side: mark the end of input, or a read error if `error` is non-zero
+static void queueFinish(BlockQueue* queue, int error) {
+    pthread_mutex_lock(&queue->lock);
+    queue->finished = 1;
+    queue->error = error;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// Consumer side: wait for the next filled buffer
+static int queueNext(BlockQueue* queue, const char** data, size_t* length) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->produced == queue->consumed && !queue->finished) {
+        pthread_cond_wait(&queue->changed, &queue->lock);
+    }
+    int result;
+    if (queue->produced != queue->consumed) {
+        *data = queue->buffers[queue->consumed % PIPELINE_DEPTH];
+        *length = queue->lengths[queue->consumed % PIPELINE_DEPTH];
+        result = 1;
+    } else {
+        errno = queue->error;
+        result = queue->error ? -1 : 0;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return result;
+}
+
+// Consumer side: hand the current buffer back to the producer
+static void queueRelease(BlockQueue* queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->consumed++;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// Consumer side: stop the producer early
+static void queueCancel(BlockQueue* queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->cancelled = 1;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// Fallback block source: a reader thread fills the queue with pread
+typedef struct PreadSource {
+    BlockSource base;
+    BlockQueue queue;
+    pthread_t thread;
+    int fd;
+    int sequential; // Pipes and other descriptors that cannot seek are read with read()
+} PreadSource;
+
+// Function run by the reader thread of a PreadSource
+static void* preadReader(void* arg) {
+    PreadSource* source = (PreadSource*)arg;
+    off_t offset = 0;
+    for (;;) {
+        char* buffer = queueAcquireEmpty(&source->queue);
+        if (buffer == NULL) {
+            break;
+        }
+        size_t filled = 0;
+        while (filled < PIPELINE_BLOCK_SIZE) {
+            ssize_t got = source->sequential
+                ? read(source->fd, buffer + filled, PIPELINE_BLOCK_SIZE - filled)
+                : pread(source->fd, buffer + filled, PIPELINE_BLOCK_SIZE - filled, offset);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got < 0) {
+                queueFinish(&source->queue, errno);
+                return NULL;
+            }
+            if (got == 0) {
+                break;
+            }
+            filled += got;
+            offset += got;
+        }
+        if (filled == 0) {
+            break;
+        }
+        queuePublish(&source->queue, filled);
+        if (filled < PIPELINE_BLOCK_SIZE) {
+            break;
+        }
+    }
+    queueFinish(&source->queue, 0);
+    return NULL;
+}
+
+static int preadNext(BlockSource* base, const char** data, size_t* length) {
+    return queueNext(&((PreadSource*)base)->queue, data, length);
+}
+
+static void preadRelease(BlockSource* base) {
+    queueRelease(&((PreadSource*)base)->queue);
+}
+
+static void preadClose(BlockSource* base) {
+    PreadSource* source = (PreadSource*)base;
+    queueCancel(&source->queue);
+    pthread_join(source->thread, NULL);
+    destroyBlockQueue(&source->queue);
+    close(source->fd);
+    free(source);
+}
+
+// Function to start a pread reader thread over an open file descriptor, which
+// it takes over. A descriptor that is not a regular file, such as a pipe, is
+// read sequentially instead.
+BlockSource* openPreadSource(int fd) {
+    PreadSource* source = (PreadSource*)calloc(1, sizeof(PreadSource));
+    if (source == NULL) {
+        perror("Failed to allocate memory for the file reader");
+        exit(EXIT_FAILURE);
+    }
+    source->base.next = preadNext;
+    source->base.release = preadRelease;
+    source->base.close = preadClose;
+    source->fd = fd;
+    struct stat info;
+    source->sequential = fstat(fd, &info) != 0 || !S_ISREG(info.st_mode);
+    initBlockQueue(&source->queue);
+    if (pthread_create(&source->thread, NULL, preadReader, source) != 0) {
+        perror("Failed to start the file reader");
+        exit(EXIT_FAILURE);
+    }
+    return &source->base;
+}
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+// Block source that keeps PIPELINE_DEPTH reads in flight with io_uring.
+// The ring is driven through the raw system calls, so no liburing is needed.
+typedef struct UringSource {
+    BlockSource base;
+    int fd;
+    off_t fileSize;
+    off_t nextOffset;        // File offset of the next read to submit
+    size_t consumed;         // Blocks released by the parser so far
+    int ringFd;
+
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    struct io_uring_sqe* sqes;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_cqe* cqes;
+    void* sqRing;
+    size_t sqRingSize;
+    void* cqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+
+    char* buffers[PIPELINE_DEPTH];
+    struct iovec vectors[PIPELINE_DEPTH];
+    off_t offsets[PIPELINE_DEPTH];
+    int inFlight[PIPELINE_DEPTH];  // A read into this buffer has not completed
+    int results[PIPELINE_DEPTH];   // Bytes read, or -errno
+} UringSource;
+
+// Function to queue a read of the next block of the file into buffer `index`
+static void uringSubmit(UringSource* source, int index) {
+    if (source->nextOffset >= source->fileSize) {
+        source->results[index] = 0; // Nothing left to read into this buffer
+        return;
+    }
+    size_t length = PIPELINE_BLOCK_SIZE;
+    if ((off_t)length > source->fileSize - source->nextOffset) {
+        length = source->fileSize - source->nextOffset;
+    }
+    source->vectors[index].iov_base = source->buffers[index];
+    source->vectors[index].iov_len = length;
+    source->offsets[index] = source->nextOffset;
+    source->nextOffset += length;
+
+    unsigned tail = *source->sqTail;
+    unsigned slot = tail & *source->sqMask;
+    struct io_uring_sqe* sqe = &source->sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = source->fd;
+    sqe->addr = (unsigned long)&source->vectors[index];
+    sqe->len = 1;
+    sqe->off = source->offsets[index];
+    sqe->user_data = index;
+    source->sqArray[slot] = slot;
+    __atomic_store_n(source->sqTail, tail + 1, __ATOMIC_RELEASE);
+    source->inFlight[index] = 1;
+
+    long submitted;
+    while ((submitted = syscall(__NR_io_uring_enter, source->ringFd, 1, 0, 0, NULL, 0)) < 0 && errno == EINTR) {
+    }
+    if (submitted < 0) {
+        // The kernel did not take the entry: withdraw it and fail this buffer's read
+        __atomic_store_n(source->sqTail, tail, __ATOMIC_RELEASE);
+        source->inFlight[index] = 0;
+        source->results[index] = -errno;
+    }
+}
+
+// Function to wait until the read into buffer `index` has completed
+static void uringWait(UringSource* source, int index) {
+    while (source->inFlight[index]) {
+        unsigned head = *source->cqHead;
+        unsigned tail = __atomic_load_n(source->cqTail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            if (syscall(__NR_io_uring_enter, source->ringFd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0
+                && errno != EINTR) {
+                // No completion can arrive any more: fail every read still in flight
+                int error = errno;
+                for (int i = 0; i < PIPELINE_DEPTH; i++) {
+                    if (source->inFlight[i]) {
+                        source->inFlight[i] = 0;
+                        source->results[i] = -error;
+                    }
+                }
+            }
+            continue;
+        }
+        for (; head != tail; head++) {
+            struct io_uring_cqe* cqe = &source->cqes[head & *source->cqMask];
+            int completed = (int)cqe->user_data;
+            source->results[completed] = cqe->res;
+            source->inFlight[completed] = 0;
+        }
+        __atomic_store_n(source->cqHead, head, __ATOMIC_RELEASE);
+    }
+}
+
+static int uringNext(BlockSource* base, const char** data, size_t* length) {
+    UringSource* source = (UringSource*)base;
+    int index = source->consumed % PIPELINE_DEPTH;
+    uringWait(source, index);
+
+    int result = source->results[index];
+    if (result < 0) {
+        errno = -result;
+        return -1;
+    }
+    // Finish a short read synchronously so the block has no hole in it. If the
+    // file shrank since it was opened, the block ends where the file now does.
+    size_t wanted = source->vectors[index].iov_len;
+    while (result > 0 && (size_t)result < wanted) {
+        ssize_t got = pread(source->fd, source->buffers[index] + result, wanted - result,
+                            source->offsets[index] + result);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0) {
+            return -1;
+        }
+        if (got == 0) {
+            break;
+        }
+        result += got;
+        source->results[index] = result;
+    }
+    *data = source->buffers[index];
+    *length = result;
+    return result > 0;
+}
+
+static void uringRelease(BlockSource* base) {
+    UringSource* source = (UringSource*)base;
+    int index = source->consumed % PIPELINE_DEPTH;
+    source->consumed++;
+    uringSubmit(source, index);
+}
+
+static void uringClose(BlockSource* base) {
+    UringSource* source = (UringSource*)base;
+    for (int i = 0; i < PIPELINE_DEPTH; i++) {
+        uringWait(source, i);
+        free(source->buffers[i]);
+    }
+    munmap(source->sqes, source->sqesSize);
+    if (source->cqRing != source->sqRing) {
+        munmap(source->cqRing, source->cqRingSize);
+    }
+    munmap(source->sqRing, source->sqRingSize);
+    close(source->ringFd);
+    close(source->fd);
+    free(source);
+}
+
+// Function to set up an io_uring over a regular file, which it takes over on success.
+// Returns NULL (leaving the file open) if io_uring is not available.
+BlockSource* openUringSource(int fd, off_t fileSize) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int ringFd = (int)syscall(__NR_io_uring_setup, PIPELINE_DEPTH, &params);
+    if (ringFd < 0) {
+        return NULL;
+    }
+
+    UringSource* source = (UringSource*)calloc(1, sizeof(UringSource));
+    if (source == NULL) {
+        perror("Failed to allocate memory for the file reader");
+        exit(EXIT_FAILURE);
+    }
+    source->ringFd = ringFd;
+    source->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    source->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (source->cqRingSize > source->sqRingSize) {
+            source->sqRingSize = source->cqRingSize;
+        }
+        source->cqRingSize = source->sqRingSize;
+    }
+    source->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    source->sqRing = mmap(NULL, source->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          ringFd, IORING_OFF_SQ_RING);
+    source->cqRing = (params.features & IORING_FEAT_SINGLE_MMAP) ? source->sqRing
+                   : mmap(NULL, source->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          ringFd, IORING_OFF_CQ_RING);
+    source->sqes = (struct io_uring_sqe*)mmap(NULL, source->sqesSize, PROT_READ | PROT_WRITE,
+                                              MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (source->sqRing == MAP_FAILED || source->cqRing == MAP_FAILED || source->sqes == MAP_FAILED) {
+        if (source->sqes != MAP_FAILED) munmap(source->sqes, source->sqesSize);
+        if (source->cqRing != MAP_FAILED && source->cqRing != source->sqRing) munmap(source->cqRing, source->cqRingSize);
+        if (source->sqRing != MAP_FAILED) munmap(source->sqRing, source->sqRingSize);
+        close(ringFd);
+        free(source);
+        return NULL;
+    }
+
+    char* sq = (char*)source->sqRing;
+    char* cq = (char*)source->cqRing;
+    source->sqTail = (unsigned*)(sq + params.sq_off.tail);
+    source->sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    source->sqArray = (unsigned*)(sq + params.sq_off.array);
+    source->cqHead = (unsigned*)(cq + params.cq_off.head);
+    source->cqTail = (unsigned*)(cq + params.cq_off.tail);
+    source->cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    source->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    source->base.next = uringNext;
+    source->base.release = uringRelease;
+    source->base.close = uringClose;
+    source->fd = fd;
+    source->fileSize = fileSize;
+    for (int i = 0; i < PIPELINE_DEPTH; i++) {
+        source->buffers[i] = (char*)malloc(PIPELINE_BLOCK_SIZE);
+        if (source->buffers[i] == NULL) {
+            perror("Failed to allocate memory for read buffers");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < PIPELINE_DEPTH; i++) {
+        uringSubmit(source, i);
+    }
+    return &source->base;
+}
+#endif
+
+// How the ingest pipeline reads the file
+typedef enum ReaderKind {
+    READER_AUTO,     // io_uring when available, otherwise a pread thread
+    READER_URING,
+    READER_PREAD
+} ReaderKind;
+
+// Function to open a file as a block source of the requested kind.
+// Returns NULL and prints why if the file cannot be read.
+BlockSource* openBlockSource(const char* path, ReaderKind reader) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening file");
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        perror("Error reading file size");
+        close(fd);
+        return NULL;
+    }
+#ifdef HAVE_IO_URING
+    if (reader != READER_PREAD && S_ISREG(info.st_mode)) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        BlockSource* source = openUringSource(fd, info.st_size);
+        if (source != NULL) {
+            return source;
+        }
+    }
+#endif
+    if (reader == READER_URING) {
+        fprintf(stderr, "Warning: io_uring is not available, reading with a pread thread\n");
+    }
+    return openPreadSource(fd);
+}
+
+// Block source that decompresses another source on its own thread. The
+// decompressed bytes go through a BlockQueue of PIPELINE_DEPTH buffers, so
+// reading, decompression and parsing all overlap and memory use stays fixed
+// however large the file is.
+typedef struct DecompressSource {
+    BlockSource base;
+    BlockQueue queue;
+    pthread_t thread;
+    BlockSource* input;      // The compressed file
+} DecompressSource;
+
+#ifdef HAVE_ZLIB
+// Function run by the decompression thread for gzip input.
+// Concatenated gzip members are decompressed one after another.
+static void* gzipDecompressor(void* arg) {
+    DecompressSource* source = (DecompressSource*)arg;
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, 15 + 32) != Z_OK) { // 15 + 32: zlib or gzip header
+        fprintf(stderr, "Error: Could not initialise gzip decompression\n");
+        queueFinish(&source->queue, EIO);
+        return NULL;
+    }
+
+    int error = 0;
+    int streamEnded = 0;
+    char* out = queueAcquireEmpty(&source->queue);
+    stream.next_out = (Bytef*)out;
+    stream.avail_out = PIPELINE_BLOCK_SIZE;
+    const char* data;
+    size_t length;
+    int status = 0;
+
+    while (out != NULL && (status = source->input->next(source->input, &data, &length)) > 0) {
+        stream.next_in = (Bytef*)data;
+        stream.avail_in = (uInt)length;
+        while (stream.avail_in > 0 && out != NULL) {
+            if (streamEnded) {
+                inflateReset(&stream); // Another gzip member follows
+                streamEnded = 0;
+            }
+            int result = inflate(&stream, Z_NO_FLUSH);
+            if (result == Z_STREAM_END) {
+                streamEnded = 1;
+            } else if (result != Z_OK && result != Z_BUF_ERROR) {
+                fprintf(stderr, "Error: Corrupt gzip data: %s\n", stream.msg ? stream.msg : "unknown error");
+                error = EIO;
+                break;
+            }
+            if (stream.avail_out == 0) {
+                queuePublish(&source->queue, PIPELINE_BLOCK_SIZE);
+                out = queueAcquireEmpty(&source->queue);
+                stream.next_out = (Bytef*)out;
+                stream.avail_out = PIPELINE_BLOCK_SIZE;
+            }
+        }
+        source->input->release(source->input);
+        if (error) {
+            break;
+        }
+    }
+    if (status < 0) {
+        error = errno;
+    } else if (!error && out != NULL && !streamEnded) {
+        fprintf(stderr, "Error: Truncated gzip data\n");
+        error = EIO;
+    }
+    if (out != NULL && stream.avail_out < PIPELINE_BLOCK_SIZE) {
+        queuePublish(&source->queue, PIPELINE_BLOCK_SIZE - stream.avail_out);
+    }
+    inflateEnd(&stream);
+    queueFinish(&source->queue, error);
+    return NULL;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+// Function run by the decompression thread for zstd input
+static void* zstdDecompressor(void* arg) {
+    DecompressSource* source = (DecompressSource*)arg;
+    ZSTD_DStream* stream = ZSTD_createDStream();
+    if (stream == NULL) {
+        fprintf(stderr, "Error: Could not initialise zstd decompression\n");
+        queueFinish(&source->queue, EIO);
+        return NULL;
+    }
+    ZSTD_initDStream(stream);
+
+    int error = 0;
+    size_t pending = 0; // Non-zero while a frame is not finished
+    ZSTD_outBuffer output = { queueAcquireEmpty(&source->queue), PIPELINE_BLOCK_SIZE, 0 };
+    const char* data;
+    size_t length;
+    int status = 0;
+
+    while (output.dst != NULL && (status = source->input->next(source->input, &data, &length)) > 0) {
+        ZSTD_inBuffer input = { data, length, 0 };
+        // Keep calling while there is input, or while a full output buffer may hide more
+        while ((input.pos < input.size || output.pos == output.size) && output.dst != NULL) {
+            if (output.pos == output.size) {
+                queuePublish(&source->queue, output.size);
+                output.dst = queueAcquireEmpty(&source->queue);
+                output.pos = 0;
+                continue;
+            }
+            pending = ZSTD_decompressStream(stream, &output, &input);
+            if (ZSTD_isError(pending)) {
+                fprintf(stderr, "Error: Corrupt zstd data: %s\n", ZSTD_getErrorName(pending));
+                error = EIO;
+                break;
+            }
+        }
+        source->input->release(source->input);
+        if (error) {
+            break;
+        }
+    }
+    if (status < 0) {
+        error = errno;
+    }
+    // At the end of the input zstd may still hold decoded bytes of the last
+    // block, so flush it with empty input until it stops producing output
+    ZSTD_inBuffer empty = { NULL, 0, 0 };
+    while (status == 0 && !error && pending != 0 && output.dst != NULL) {
+        if (output.pos == output.size) {
+            queuePublish(&source->queue, output.size);
+            output.dst = queueAcquireEmpty(&source->queue);
+            output.pos = 0;
+            continue;
+        }
+        size_t before = output.pos;
+        pending = ZSTD_decompressStream(stream, &output, &empty);
+        if (ZSTD_isError(pending)) {
+            fprintf(stderr, "Error: Corrupt zstd data: %s\n", ZSTD_getErrorName(pending));
+            error = EIO;
+        } else if (output.pos == before) {
+            break; // No progress: the frame needs input that is not there
+        }
+    }
+    if (!error && status == 0 && output.dst != NULL && pending != 0) {
+        fprintf(stderr, "Error: Truncated zstd data\n");
+        error = EIO;
+    }
+    if (output.dst != NULL && output.pos > 0) {
+        queuePublish(&source->queue, output.pos);
+    }
+    ZSTD_freeDStream(stream);
+    queueFinish(&source->queue, error);
+    return NULL;
+}
+#endif
+
+static int decompressNext(BlockSource* base, const char** data, size_t* length) {
+    return queueNext(&((DecompressSource*)base)->queue, data, length);
+}
+
+static void decompressRelease(BlockSource* base) {
+    queueRelease(&((DecompressSource*)base)->queue);
+}
+
+static void decompressClose(BlockSource* base) {
+    DecompressSource* source = (DecompressSource*)base;
+    queueCancel(&source->queue);
+    pthread_join(source->thread, NULL);
+    destroyBlockQueue(&source->queue);
+    source->input->close(source->input);
+    free(source);
+}
+
+// Function to open a file for ingest, decompressing it on a separate thread
+// when its magic bytes say it is gzip or zstd.
+// Returns NULL and prints why if the file cannot be read.
+BlockSource* openInputSource(const char* path, ReaderKind reader) {
+    BlockSource* input = openBlockSource(path, reader);
+    if (input == NULL) {
+        return NULL;
+    }
+
+    // Peek at the first block; it stays pending until released
+    const char* data = NULL;
+    size_t length = 0;
+    if (input->next(input, &data, &length) <= 0) {
+        return input;
+    }
+    CompressionFormat format = detectCompression(data, length);
+    if (format == COMPRESSION_NONE) {
+        return input;
+    }
+
+    void* (*decompressor)(void*) = NULL;
+#ifdef HAVE_ZLIB
+    if (format == COMPRESSION_GZIP) {
+        decompressor = gzipDecompressor;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (format == COMPRESSION_ZSTD) {
+        decompressor = zstdDecompressor;
+    }
+#endif
+    if (decompressor == NULL) {
+        fprintf(stderr, "Error: %s is %s-compressed but this program was built without %s support\n",
+                path, format == COMPRESSION_GZIP ? "gzip" : "zstd",
+                format == COMPRESSION_GZIP ? "zlib (-DHAVE_ZLIB -lz)" : "zstd (-DHAVE_ZSTD -lzstd)");
+        input->close(input);
+        return NULL;
+    }
+
+    DecompressSource* source = (DecompressSource*)calloc(1, sizeof(DecompressSource));
+    if (source == NULL) {
+        perror("Failed to allocate memory for the decompressor");
+        exit(EXIT_FAILURE);
+    }
+    source->base.next = decompressNext;
+    source->base.release = decompressRelease;
+    source->base.close = decompressClose;
+    source->input = input;
+    initBlockQueue(&source->queue);
+    if (pthread_create(&source->thread, NULL, decompressor, source) != 0) {
+        perror("Failed to start the decompressor");
+        exit(EXIT_FAILURE);
+    }
+    return &source->base;
+}
+
+// Function to split the blocks of a source into lines and load them.
+// A line that spans a block boundary is carried over and completed from the
+// next block, so every line reaches loadLine() whole.
+// Returns the number of movies loaded, or -1 on error.
+int loadFromSource(BlockSource* source, LoadState* state) {
+    char carry[1024];        // Start of a line continued in the next block
+    size_t carryLength = 0;
+    int carrying = 0;
+    const char* data;
+    size_t length;
+    int status;
+
+    while ((status = source->next(source, &data, &length)) > 0) {
+        const char* cursor = data;
+        const char* end = data + length;
+        while (cursor < end) {
+            const char* newline = (const char*)memchr(cursor, '\n', end - cursor);
+            const char* lineEnd = newline != NULL ? newline : end;
+            if (carrying || newline == NULL) {
+                // Lines longer than the carry buffer are truncated, as with fgets
+                size_t take = lineEnd - cursor;
+                if (take > sizeof(carry) - carryLength) {
+                    take = sizeof(carry) - carryLength;
+                }
+                memcpy(carry + carryLength, cursor, take);
+                carryLength += take;
+                carrying = 1;
+                if (newline != NULL) {
+                    loadLine(state, carry, carryLength, 0);
+                    carryLength = 0;
+                    carrying = 0;
+                }
+            } else {
+                loadLine(state, cursor, lineEnd - cursor, 0);
+            }
+            cursor = newline != NULL ? newline + 1 : end;
+        }
+        source->release(source);
+    }
+    if (status < 0) {
+        perror("Error reading file");
+        return -1;
+    }
+    if (carrying) {
+        loadLine(state, carry, carryLength, 0);
+    }
+    return finishLoad(state);
+}
+
+// HyperLogLog distinct counter with 2^14 registers (standard error about 0.8%)
+#define HLL_PRECISION 14
+#define HLL_REGISTERS (1 << HLL_PRECISION)
+
+typedef struct HyperLogLog {
+    unsigned char registers[HLL_REGISTERS];
+} HyperLogLog;
+
+// Function to add a hashed item to a HyperLogLog
+static void hllAdd(HyperLogLog* hll, unsigned long long hash) {
+    unsigned int index = (unsigned int)(hash >> (64 - HLL_PRECISION));
+    unsigned long long rest = hash << HLL_PRECISION;
+    unsigned char rank = rest == 0 ? 64 - HLL_PRECISION + 1 : (unsigned char)(__builtin_clzll(rest) + 1);
+    if (rank > hll->registers[index]) {
+        hll->registers[index] = rank;
+    }
+}
+
+// Function to estimate the number of distinct items added to a HyperLogLog
+static double hllEstimate(const HyperLogLog* hll) {
+    double sum = 0.0;
+    int zeros = 0;
+    for (int i = 0; i < HLL_REGISTERS; i++) {
+        sum += ldexp(1.0, -hll->registers[i]);
+        zeros += hll->registers[i] == 0;
+    }
+    double m = HLL_REGISTERS;
+    double estimate = (0.7213 / (1.0 + 1.079 / m)) * m * m / sum;
+    if (estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * log(m / zeros); // Linear counting for small cardinalities
+    }
+    return estimate;
+}
+
+// Merging t-digest for quantiles of a stream of ratings. Centroid sizes are
+// bounded by the arcsine scale function, so the digest never holds more than
+// about TDIGEST_COMPRESSION centroids and is most accurate in the tails.
+#define TDIGEST_COMPRESSION 100
+#define TDIGEST_CAPACITY (2 * TDIGEST_COMPRESSION)
+#define TDIGEST_BUFFER 256
+
+typedef struct TDigestCentroid {
+    double mean;
+    double weight;
+} TDigestCentroid;
+
+typedef struct TDigest {
+    TDigestCentroid centroids[TDIGEST_CAPACITY + TDIGEST_BUFFER];
+    int centroidCount;        // Merged centroids, sorted by mean
+    int bufferedCount;        // Unmerged points after them
+    double totalWeight;       // Weight of the merged centroids
+    double min;
+    double max;
+} TDigest;
+
+static int compareCentroids(const void* a, const void* b) {
+    double left = ((const TDigestCentroid*)a)->mean;
+    double right = ((const TDigestCentroid*)b)->mean;
+    return (left > right) - (left < right);
+}
+
+// Function to merge the buffered points into the digest's centroids
+static void tdigestCompress(TDigest* digest) {
+    if (digest->bufferedCount == 0) {
+        return;
+    }
+    int count = digest->centroidCount + digest->bufferedCount;
+    double total = digest->totalWeight + digest->bufferedCount;
+    qsort(digest->centroids, count, sizeof(TDigestCentroid), compareCentroids);
+
+    const double scale = TDIGEST_COMPRESSION / (2.0 * M_PI);
+    int merged = 0;
+    double weightSoFar = 0.0;
+    double limit = total * (sin((asin(-1.0) * scale + 1.0) / scale) + 1.0) / 2.0;
+    TDigestCentroid current = digest->centroids[0];
+    for (int i = 1; i < count; i++) {
+        TDigestCentroid next = digest->centroids[i];
+        if (weightSoFar + current.weight + next.weight <= limit) {
+            current.mean += (next.mean - current.mean) * next.weight / (current.weight + next.weight);
+            current.weight += next.weight;
+        } else {
+            weightSoFar += current.weight;
+            digest->centroids[merged++] = current;
+            double k = asin(2.0 * weightSoFar / total - 1.0) * scale + 1.0;
+            limit = k >= TDIGEST_COMPRESSION / 4.0 ? total : total * (sin(k / scale) + 1.0) / 2.0;
+            current = next;
+        }
+    }
+    digest->centroids[merged++] = current;
+    digest->centroidCount = merged;
+    digest->bufferedCount = 0;
+    digest->totalWeight = total;
+}
+
+// Function to add a value to a t-digest
+static void tdigestAdd(TDigest* digest, double value) {
+    if (digest->totalWeight == 0 && digest->bufferedCount == 0) {
+        digest->min = digest->max = value;
+    }
+    if (value < digest->min) digest->min = value;
+    if (value > digest->max) digest->max = value;
+    TDigestCentroid* point = &digest->centroids[digest->centroidCount + digest->bufferedCount++];
+    point->mean = value;
+    point->weight = 1.0;
+    if (digest->bufferedCount == TDIGEST_BUFFER) {
+        tdigestCompress(digest);
+    }
+}
+
+// Function to estimate the q-quantile (0 <= q <= 1) of the values in a t-digest
+static double tdigestQuantile(TDigest* digest, double q) {
+    tdigestCompress(digest);
+    if (digest->centroidCount == 0) {
+        return 0.0;
+    }
+    double rank = q * digest->totalWeight;
+    double cumulative = 0.0;
+    for (int i = 0; i < digest->centroidCount; i++) {
+        const TDigestCentroid* c = &digest->centroids[i];
+        double center = cumulative + c->weight / 2.0;
+        if (rank < center) {
+            // Interpolate from the previous centroid's center (or the minimum)
+            double leftMean = i == 0 ? digest->min : digest->centroids[i - 1].mean;
+            double leftCenter = i == 0 ? 0.0 : cumulative - digest->centroids[i - 1].weight / 2.0;
+            if (center == leftCenter) {
+                return c->mean;
+            }
+            return leftMean + (c->mean - leftMean) * (rank - leftCenter) / (center - leftCenter);
+        }
+        cumulative += c->weight;
+    }
+    return digest->max;
+}
+
+// Count-Min sketch for language frequencies plus a Space-Saving summary that
+// tracks the candidates for the most common languages
+#define COUNT_MIN_DEPTH 4
+#define COUNT_MIN_WIDTH 2048
+#define SPACE_SAVING_SLOTS 64
+
+typedef struct HeavyHitter {
+    char label[48];          // Spelling of the language when it entered the summary
+    unsigned long long hash; // Hash of the lowercase language
+    unsigned long count;     // Overestimate of the frequency
+    unsigned long error;     // Maximum overestimation
+} HeavyHitter;
+
+typedef struct LanguageSketch {
+    unsigned int counts[COUNT_MIN_DEPTH][COUNT_MIN_WIDTH];
+    HeavyHitter slots[SPACE_SAVING_SLOTS];
+    int slotCount;
+    unsigned long total;
+} LanguageSketch;
+
+// Function to count one occurrence of a language
+static void languageSketchAdd(LanguageSketch* sketch, const char* language, size_t length) {
+    char lower[48];
+    if (length >= sizeof(lower)) {
+        length = sizeof(lower) - 1;
+    }
+    for (size_t i = 0; i < length; i++) {
+        lower[i] = tolower((unsigned char)language[i]);
+    }
+    unsigned long long hash = hashBytes(lower, length);
+    sketch->total++;
+
+    unsigned int h1 = (unsigned int)hash;
+    unsigned int h2 = (unsigned int)(hash >> 32) | 1;
+    for (int d = 0; d < COUNT_MIN_DEPTH; d++) {
+        sketch->counts[d][(h1 + d * h2) % COUNT_MIN_WIDTH]++;
+    }
+
+    int smallest = 0;
+    for (int i = 0; i < sketch->slotCount; i++) {
+        if (sketch->slots[i].hash == hash) {
+            sketch->slots[i].count++;
+            return;
+        }
+        if (sketch->slots[i].count < sketch->slots[smallest].count) {
+            smallest = i;
+        }
+    }
+    HeavyHitter* slot;
+    unsigned long floor = 0;
+    if (sketch->slotCount < SPACE_SAVING_SLOTS) {
+        slot = &sketch->slots[sketch->slotCount++];
+    } else {
+        slot = &sketch->slots[smallest]; // Replace the least frequent candidate
+        floor = slot->count;
+    }
+    memcpy(slot->label, language, length);
+    slot->label[length] = '\0';
+    slot->hash = hash;
+    slot->count = floor + 1;
+    slot->error = floor;
+}
+
+// Function to get the Count-Min estimate of a language's frequency
+static unsigned long languageSketchEstimate(const LanguageSketch* sketch, unsigned long long hash) {
+    unsigned int h1 = (unsigned int)hash;
+    unsigned int h2 = (unsigned int)(hash >> 32) | 1;
+    unsigned long estimate = ~0UL;
+    for (int d = 0; d < COUNT_MIN_DEPTH; d++) {
+        unsigned long count = sketch->counts[d][(h1 + d * h2) % COUNT_MIN_WIDTH];
+        if (count < estimate) {
+            estimate = count;
+        }
+    }
+    return estimate;
+}
+
+// Years that get their own rating digest; others are only counted
+#define STATS_FIRST_YEAR 1800
+#define STATS_YEARS 400
+
+// Everything the statistics mode keeps. Its size is fixed: it does not grow
+// with the number of rows.
+typedef struct StreamingStats {
+    HyperLogLog titles;
+    TDigest* ratingsByYear[STATS_YEARS]; // Allocated the first time a year is seen
+    unsigned long rowsByYear[STATS_YEARS];
+    unsigned long rowsOutsideYears;
+    LanguageSketch languages;
+    unsigned long rows;
+} StreamingStats;
+
+// Row sink for the statistics mode: fold one row into every sketch
+static void addRowToStats(void* context, const ParsedRow* row) {
+    StreamingStats* stats = (StreamingStats*)context;
+    stats->rows++;
+    hllAdd(&stats->titles, hashBytes(row->title, row->titleLength));
+
+    int slot = row->year - STATS_FIRST_YEAR;
+    if (slot >= 0 && slot < STATS_YEARS) {
+        if (stats->ratingsByYear[slot] == NULL) {
+            stats->ratingsByYear[slot] = (TDigest*)calloc(1, sizeof(TDigest));
+            if (stats->ratingsByYear[slot] == NULL) {
+                perror("Failed to allocate memory for a rating digest");
+                exit(EXIT_FAILURE);
+            }
+        }
+        tdigestAdd(stats->ratingsByYear[slot], row->rating);
+        stats->rowsByYear[slot]++;
+    } else {
+        stats->rowsOutsideYears++;
+    }
+
+    const char* languages = row->languages;
+    size_t length = row->languagesLength;
+    if (length >= 2 && languages[0] == '[' && languages[length - 1] == ']') {
+        languages++;
+        length -= 2;
+    }
+    const char* end = languages + length;
+    while (languages < end) {
+        const char* separator = (const char*)memchr(languages, ';', end - languages);
+        const char* tokenEnd = separator != NULL ? separator : end;
+        const char* start = languages;
+        const char* stop = tokenEnd;
+        while (start < stop && *start == ' ') start++;
+        while (stop > start && stop[-1] == ' ') stop--;
+        if (stop > start) {
+            languageSketchAdd(&stats->languages, start, stop - start);
+        }
+        languages = separator != NULL ? separator + 1 : end;
+    }
+}
+
+static int compareHeavyHitters(const void* a, const void* b) {
+    unsigned long left = ((const HeavyHitter*)a)->count;
+    unsigned long right = ((const HeavyHitter*)b)->count;
+    return (left < right) - (left > right);
+}
+
+// Function to print the summaries gathered by the statistics mode
+void printStreamingStats(StreamingStats* stats) {
+    printf("Distinct titles (HyperLogLog): about %.0f\n", hllEstimate(&stats->titles));
+
+    printf("\nRating distribution per year (t-digest):\n");
+    printf("Year   Movies   Min   P10   P25  Median   P75   P90   Max\n");
+    for (int slot = 0; slot < STATS_YEARS; slot++) {
+        TDigest* digest = stats->ratingsByYear[slot];
+        if (digest == NULL) {
+            continue;
+        }
+        printf("%d %8lu %5.1f %5.1f %5.1f %7.1f %5.1f %5.1f %5.1f\n",
+               STATS_FIRST_YEAR + slot, stats->rowsByYear[slot], digest->min,
+               tdigestQuantile(digest, 0.10), tdigestQuantile(digest, 0.25),
+               tdigestQuantile(digest, 0.50), tdigestQuantile(digest, 0.75),
+               tdigestQuantile(digest, 0.90), digest->max);
+    }
+    if (stats->rowsOutsideYears > 0) {
+        printf("(%lu movies released outside %d-%d)\n", stats->rowsOutsideYears,
+               STATS_FIRST_YEAR, STATS_FIRST_YEAR + STATS_YEARS - 1);
+    }
+
+    printf("\nMost common languages (Space-Saving, Count-Min estimate):\n");
+    HeavyHitter top[SPACE_SAVING_SLOTS];
+    memcpy(top, stats->languages.slots, sizeof(HeavyHitter) * stats->languages.slotCount);
+    qsort(top, stats->languages.slotCount, sizeof(HeavyHitter), compareHeavyHitters);
+    for (int i = 0; i < stats->languages.slotCount && i < 10; i++) {
+        unsigned long estimate = languageSketchEstimate(&stats->languages, top[i].hash);
+        if (estimate > top[i].count) {
+            estimate = top[i].count; // Both sketches only overestimate
+        }
+        printf("%-20s about %lu (at least %lu)\n", top[i].label, estimate, top[i].count - top[i].error);
+    }
+}
+
+// Function to free the digests allocated by the statistics mode
+void freeStreamingStats(StreamingStats* stats) {
+    for (int slot = 0; slot < STATS_YEARS; slot++) {
+        free(stats->ratingsByYear[slot]);
+    }
+}
+
+// Queries the streaming mode can answer while the file is parsed
+typedef enum StreamQueryKind {
+    STREAM_BY_YEAR,
+    STREAM_BY_LANGUAGE,
+    STREAM_BEST_PER_YEAR
+} StreamQueryKind;
+
+// Where a year's best movie is kept in a streaming best-per-year query
+typedef struct YearSlot {
+    int used;
+    int year;
+    size_t index;            // Position in StreamQuery.matches
+} YearSlot;
+
+// State of a query answered in a single pass over the file. Only matches that
+// must be held (for sorting, or the current best of each year) are kept, so
+// memory is proportional to the result, not to the file.
+typedef struct StreamQuery {
+    StreamQueryKind kind;
+    int year;
+    char language[256];      // Lowercase search term
+    size_t languageLength;
+    const char* originalTerm; // Search term as given, for messages
+    const QueryOptions* options;
+    ResultSet matches;       // Held matches, in order of first appearance
+    YearSlot* yearSlots;     // Open-addressing map from year to its best movie
+    size_t slotCapacity;
+    unsigned long matchCount;
+} StreamQuery;
+
+// Function to create a movie node for a matching row
+static Movie* movieFromRow(const ParsedRow* row) {
+    char title[256];
+    char languages[256];
+    memcpy(title, row->title, row->titleLength);
+    title[row->titleLength] = '\0';
+    memcpy(languages, row->languages, row->languagesLength);
+    languages[row->languagesLength] = '\0';
+    return createMovieNode(title, row->year, languages, row->rating);
+}
+
+// Function to print one match in the format of the corresponding menu query
+static void printStreamMatch(const StreamQuery* query, const Movie* movie) {
+    if (query->kind == STREAM_BY_YEAR) {
+        printf("%s\n", movie->title);
+    } else if (query->kind == STREAM_BY_LANGUAGE) {
+        printf("%d %s\n", movie->year, movie->title);
+    } else {
+        printf("%d %.1f %s\n", movie->year, movie->rating, movie->title);
+    }
+}
+
+// Function to find the slot of a year in a streaming best-per-year query, growing the map as needed
+static YearSlot* findYearSlot(StreamQuery* query, int year) {
+    if ((query->matches.count + 1) * 2 > query->slotCapacity) {
+        YearSlot* old = query->yearSlots;
+        size_t oldCapacity = query->slotCapacity;
+        query->slotCapacity = oldCapacity ? oldCapacity * 2 : 256;
+        query->yearSlots = (YearSlot*)calloc(query->slotCapacity, sizeof(YearSlot));
+        if (query->yearSlots == NULL) {
+            perror("Failed to allocate memory for the streaming query");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < oldCapacity; i++) {
+            if (old[i].used) {
+                size_t slot = (unsigned int)old[i].year * 2654435761u & (query->slotCapacity - 1);
+                while (query->yearSlots[slot].used) {
+                    slot = (slot + 1) & (query->slotCapacity - 1);
+                }
+                query->yearSlots[slot] = old[i];
+            }
+        }
+        free(old);
+    }
+    size_t slot = (unsigned int)year * 2654435761u & (query->slotCapacity - 1);
+    while (query->yearSlots[slot].used && query->yearSlots[slot].year != year) {
+        slot = (slot + 1) & (query->slotCapacity - 1);
+    }
+    return &query->yearSlots[slot];
+}
+
+// Row sink for the streaming query mode: evaluate the query on one parsed row
+static void evaluateStreamQuery(void* context, const ParsedRow* row) {
+    StreamQuery* query = (StreamQuery*)context;
+
+    if (query->kind == STREAM_BEST_PER_YEAR) {
+        YearSlot* slot = findYearSlot(query, row->year);
+        if (!slot->used) {
+            slot->used = 1;
+            slot->year = row->year;
+            slot->index = query->matches.count;
+            appendResult(&query->matches, movieFromRow(row));
+        } else if (row->rating > query->matches.rows[slot->index]->rating) {
+            Movie* best = query->matches.rows[slot->index];
+            memcpy(best->title, row->title, row->titleLength);
+            best->title[row->titleLength] = '\0';
+            best->rating = row->rating;
+        }
+        return;
+    }
+
+    int match;
+    if (query->kind == STREAM_BY_YEAR) {
+        match = row->year == query->year;
+    } else {
+        const char* languages = row->languages;
+        const char* end = languages + row->languagesLength;
+        if (end - languages >= 2 && languages[0] == '[' && end[-1] == ']') {
+            languages++;
+            end--;
+        }
+        match = languageListContains(languages, end, query->language, query->languageLength);
+    }
+    if (!match) {
+        return;
+    }
+
+    query->matchCount++;
+    Movie* movie = movieFromRow(row);
+    if (query->options->sortKey == SORT_NONE) {
+        // Emit right away; nothing about the row is kept
+        printStreamMatch(query, movie);
+        free(movie);
+    } else {
+        appendResult(&query->matches, movie);
+    }
+}
+
+// Function to parse a --query= specification into a streaming query.
+// Returns 0 on success or -1 if it is not understood.
+int parseStreamQuery(const char* spec, StreamQuery* query) {
+    memset(query, 0, sizeof(*query));
+    if (strncmp(spec, "year:", 5) == 0) {
+        char* end;
+        query->kind = STREAM_BY_YEAR;
+        query->year = (int)strtol(spec + 5, &end, 10);
+        return end != spec + 5 && *end == '\0' ? 0 : -1;
+    }
+    if (strncmp(spec, "language:", 9) == 0 && strlen(spec + 9) < sizeof(query->language)) {
+        query->kind = STREAM_BY_LANGUAGE;
+        query->originalTerm = spec + 9;
+        for (const char* p = spec + 9; *p; p++) {
+            query->language[query->languageLength++] = tolower((unsigned char)*p);
+        }
+        return 0;
+    }
+    if (strcmp(spec, "best-per-year") == 0) {
+        query->kind = STREAM_BEST_PER_YEAR;
+        return 0;
+    }
+    return -1;
+}
+
+// Function to answer a query in a single pass over the file without building
+// the dataset. Matches are printed as they are parsed unless they must be
+// sorted first. Returns the number of rows parsed, or -1 on error.
+int runStreamQuery(const char* path, ReaderKind reader, StreamQuery* query, const QueryOptions* options,
+                   Quarantine* quarantine) {
+    BlockSource* source = openInputSource(path, reader);
+    if (source == NULL) {
+        return -1;
+    }
+    query->options = options;
+    LoadState state = {0};
+    state.rowSink = evaluateStreamQuery;
+    state.sinkContext = query;
+    state.quarantine = quarantine;
+    int rowCount = loadFromSource(source, &state);
+    source->close(source);
+
+    if (rowCount >= 0) {
+        sortResults(NULL, &query->matches, options);
+        for (size_t i = 0; i < query->matches.count; i++) {
+            printStreamMatch(query, query->matches.rows[i]);
+        }
+        if (query->kind == STREAM_BY_YEAR && query->matchCount == 0) {
+            printf("No data about movies released in the year %d\n", query->year);
+        } else if (query->kind == STREAM_BY_LANGUAGE && query->matchCount == 0) {
+            printf("No data about movies released in %s\n", query->originalTerm);
+        }
+    }
+    for (size_t i = 0; i < query->matches.count; i++) {
+        free(query->matches.rows[i]);
+    }
+    freeResults(&query->matches);
+    free(query->yearSlots);
+    return rowCount;
+}
+
+// Function to answer the queries listed in the file at `path`, one per line in
+// the --query syntax, with a single shared scan of the dataset. Only year and
+// language queries can be batched; empty lines and lines starting with '#'
+// are ignored. Results are printed in the order the queries are listed.
+// Returns 0, or -1 if the file cannot be read or holds an invalid query.
+int runBatchQueries(const Dataset* dataset, const char* path, const QueryOptions* options) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        perror("Error opening batch file");
+        return -1;
+    }
+    SharedScan scan = {0};
+    char (*specs)[300] = NULL;
+    char line[300];
+    int status = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+        StreamQuery query;
+        if (parseStreamQuery(line, &query) != 0 || query.kind == STREAM_BEST_PER_YEAR) {
+            fprintf(stderr, "Invalid batch query: %s\n", line);
+            status = -1;
+            break;
+        }
+        size_t q = addPendingQuery(&scan, query.year, query.kind == STREAM_BY_LANGUAGE ? query.language : NULL);
+        if (q % 16 == 0) {
+            char (*newSpecs)[300] = realloc(specs, (q + 16) * sizeof(*specs));
+            if (newSpecs == NULL) {
+                perror("Failed to allocate memory for pending queries");
+                exit(EXIT_FAILURE);
+            }
+            specs = newSpecs;
+        }
+        strcpy(specs[q], line);
+    }
+    fclose(file);
+
+    if (status == 0) {
+        size_t blocksSkipped = runSharedScan(dataset, &scan, options->workers);
+        for (size_t q = 0; q < scan.count; q++) {
+            PendingQuery* query = &scan.queries[q];
+            sortResults(dataset, &query->results, options);
+            printf("\nResults of %s\n", specs[q]);
+            if (query->results.count == 0 && query->byLanguage) {
+                printf("No data about movies released in %s\n", specs[q] + 9); // After "language:"
+            } else if (query->results.count == 0) {
+                printf("No data about movies released in the year %d\n", query->year);
+            }
+            for (size_t i = 0; i < query->results.count; i++) {
+                Movie* movie = query->results.rows[i];
+                if (query->byLanguage) {
+                    printf("%d ", movie->year);
+                }
+                printf("%s", movieTitle(movie));
+                printJoinedColumns(dataset, movie);
+            }
+        }
+        printf("\nAnswered %zu queries with one scan of %zu movies, %zu of %zu blocks skipped\n",
+               scan.count, dataset->count, blocksSkipped, dataset->blockCount);
+    }
+    free(specs);
+    freeSharedScan(&scan);
+    return status;
+}
+
+// Function to return the current time in seconds from a monotonic clock
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to time `iterations` scans with the given worker count, returning seconds per scan
+static double timeScan(const Dataset* dataset, RowPredicate predicate, BlockPredicate blockPredicate,
+                       const void* argument, int workers, int iterations, size_t* matches,
+                       size_t* blocksSkipped) {
+    double start = nowSeconds();
+    for (int i = 0; i < iterations; i++) {
+        ResultSet results = {0};
+        *blocksSkipped = parallelScan(dataset, predicate, blockPredicate, argument, workers, &results);
+        *matches = results.count;
+        freeResults(&results);
+    }
+    return (nowSeconds() - start) / iterations;
+}
+
+// Function to time `iterations` runs of the specialized kernel for a filter, returning seconds per run
+static double timeKernelScan(const Dataset* dataset, const ScanFilter* filter, ScanSink sink,
+                             int workers, int iterations, size_t* matches) {
+    double start = nowSeconds();
+    for (int i = 0; i < iterations; i++) {
+        ResultSet results = {0};
+        *matches = filteredScan(dataset, filter, sink, workers, &results);
+        freeResults(&results);
+    }
+    return (nowSeconds() - start) / iterations;
+}
+
+// Menu queries answered from the index
+typedef enum IndexQuery {
+    INDEX_YEAR,
+    INDEX_LANGUAGE,
+    INDEX_BEST_PER_YEAR
+} IndexQuery;
+
+// Function to time `iterations` answers of a menu query from the dataset's
+// index, returning seconds per answer
+static double timeIndexQuery(const Dataset* dataset, IndexQuery query, int year, const char* language,
+                             int iterations, size_t* matches) {
+    double start = nowSeconds();
+    for (int i = 0; i < iterations; i++) {
+        ResultSet results = {0};
+        if (query == INDEX_YEAR) {
+            collectMoviesByYear(dataset, year, 1, &results);
+        } else if (query == INDEX_LANGUAGE) {
+            collectMoviesByLanguage(dataset, language, 1, &results);
+        } else {
+            collectHighestRatedPerYear(dataset, 1, &results);
+        }
+        *matches = results.count;
+        freeResults(&results);
+    }
+    return (nowSeconds() - start) / iterations;
+}
+
+// Function to copy the first language of a movie, lowercased, for use as a search term
+static void firstLanguageOf(const Movie* movie, char* language, size_t size) {
+    const char* languages = movieLanguages(movie);
+    size_t length = strcspn(languages, ";");
+    while (length > 0 && languages[length - 1] == ' ') length--;
+    while (length > 0 && languages[0] == ' ') {
+        languages++;
+        length--;
+    }
+    if (length > size - 1) {
+        length = size - 1;
+    }
+    for (size_t i = 0; i < length; i++) {
+        language[i] = tolower((unsigned char)languages[i]);
+    }
+    language[length] = '\0';
+}
+
+// Function to benchmark the year and language scans with one worker and with
+// the configured number of workers, and report the speedup. Then build the
+// index and time the lookups that menu options 1 to 3 make in it.
+void runScanBenchmark(Dataset* dataset, const QueryOptions* options) {
+    if (dataset->count == 0) {
+        printf("No movies to benchmark\n");
+        return;
+    }
+
+    // Query the year and first language of the first movie so both scans find matches
+    int year = dataset->rows[0]->year;
+    char language[256];
+    firstLanguageOf(dataset->rows[0], language, sizeof(language));
+
+    int iterations = (int)(20000000 / (dataset->count + 1)) + 1;
+    if (iterations > 1000) {
+        iterations = 1000;
+    }
+
+    printf("Scan benchmark: %zu movies, %d workers, %d iterations\n",
+           dataset->count, options->workers, iterations);
+
+    struct {
+        const char* name;
+        RowPredicate predicate;
+        BlockPredicate blockPredicate;
+        const void* argument;
+    } scans[] = {
+        { "year", matchesYear, blockMayMatchYear, &year },
+        { "language", matchesLanguage, blockMayMatchLanguage, language },
+    };
+    for (size_t i = 0; i < sizeof(scans) / sizeof(scans[0]); i++) {
+        size_t matches = 0;
+        size_t blocksSkipped = 0;
+        double serial = timeScan(dataset, scans[i].predicate, scans[i].blockPredicate, scans[i].argument,
+                                 1, iterations, &matches, &blocksSkipped);
+        double parallel = timeScan(dataset, scans[i].predicate, scans[i].blockPredicate, scans[i].argument,
+                                   options->workers, iterations, &matches, &blocksSkipped);
+        printf("%-8s scan: %zu matches, %zu of %zu blocks skipped, 1 worker %.3f ms, %d workers %.3f ms, speedup %.2fx\n",
+               scans[i].name, matches, blocksSkipped, dataset->blockCount, serial * 1e3,
+               options->workers, parallel * 1e3, parallel > 0 ? serial / parallel : 0.0);
+    }
+
+    // The same queries through the specialized kernels the menu uses
+    struct {
+        const char* name;
+        ScanFilter filter;
+        ScanSink sink;
+    } kernels[] = {
+        { "year", { .useYear = 1, .minYear = year, .maxYear = year }, SINK_COLLECT },
+        { "language", { .useLanguage = 1, .language = language }, SINK_COLLECT },
+        { "year count", { .useYear = 1, .minYear = year, .maxYear = year }, SINK_COUNT },
+    };
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        size_t matches = 0;
+        double serial = timeKernelScan(dataset, &kernels[i].filter, kernels[i].sink, 1, iterations, &matches);
+        double parallel = timeKernelScan(dataset, &kernels[i].filter, kernels[i].sink,
+                                         options->workers, iterations, &matches);
+        printf("%-10s kernel: %zu matches, 1 worker %.3f ms, %d workers %.3f ms, speedup %.2fx\n",
+               kernels[i].name, matches, serial * 1e3, options->workers, parallel * 1e3,
+               parallel > 0 ? serial / parallel : 0.0);
+    }
+
+    // Up to eight years and eight first languages of the first movies, run as
+    // one kernel scan per query and then together as one shared scan
+    SharedScan scan = {0};
+    size_t yearQueries = 0;
+    size_t languageQueries = 0;
+    for (size_t i = 0; i < dataset->count && (yearQueries < 8 || languageQueries < 8); i++) {
+        const Movie* movie = dataset->rows[i];
+        firstLanguageOf(movie, language, sizeof(language));
+        int newYear = yearQueries < 8;
+        int newLanguage = languageQueries < 8 && language[0] != '\0';
+        for (size_t q = 0; q < scan.count; q++) {
+            const PendingQuery* query = &scan.queries[q];
+            if (query->byLanguage) {
+                newLanguage &= strcmp(query->language, language) != 0;
+            } else {
+                newYear &= query->year != movie->year;
+            }
+        }
+        if (newYear) {
+            addPendingQuery(&scan, movie->year, NULL);
+            yearQueries++;
+        }
+        if (newLanguage) {
+            addPendingQuery(&scan, 0, language);
+            languageQueries++;
+        }
+    }
+    size_t separateMatches = 0;
+    double start = nowSeconds();
+    for (int i = 0; i < iterations; i++) {
+        separateMatches = 0;
+        for (size_t q = 0; q < scan.count; q++) {
+            const PendingQuery* query = &scan.queries[q];
+            ScanFilter filter = { .useYear = !query->byLanguage, .minYear = query->year, .maxYear = query->year,
+                                  .useLanguage = query->byLanguage, .language = query->language };
+            ResultSet results = {0};
+            separateMatches += filteredScan(dataset, &filter, SINK_COLLECT, options->workers, &results);
+            freeResults(&results);
+        }
+    }
+    double separate = (nowSeconds() - start) / iterations;
+    size_t sharedMatches = 0;
+    start = nowSeconds();
+    for (int i = 0; i < iterations; i++) {
+        runSharedScan(dataset, &scan, options->workers);
+        sharedMatches = 0;
+        for (size_t q = 0; q < scan.count; q++) {
+            sharedMatches += scan.queries[q].results.count;
+            freeResults(&scan.queries[q].results);
+        }
+    }
+    double shared = (nowSeconds() - start) / iterations;
+    printf("shared scan: %zu queries, %zu matches, separate kernels %.3f ms (%zu matches), one shared scan %.3f ms, speedup %.2fx\n",
+           scan.count, sharedMatches, separate * 1e3, separateMatches, shared * 1e3,
+           shared > 0 ? separate / shared : 0.0);
+    freeSharedScan(&scan);
+
+    // An attached dataset is read-only and has no index; its menu queries scan
+    if (dataset->sharedSegment != NULL) {
+        printf("index: not built for a shared dataset\n");
+        return;
+    }
+    start = nowSeconds();
+    buildDatasetIndex(dataset);
+    printf("index: built in %.3f ms\n", (nowSeconds() - start) * 1e3);
+    firstLanguageOf(dataset->rows[0], language, sizeof(language));
+    struct {
+        const char* name;
+        IndexQuery query;
+    } lookups[] = {
+        { "year", INDEX_YEAR },
+        { "language", INDEX_LANGUAGE },
+        { "best per year", INDEX_BEST_PER_YEAR },
+    };
+    for (size_t i = 0; i < sizeof(lookups) / sizeof(lookups[0]); i++) {
+        size_t matches = 0;
+        double elapsed = timeIndexQuery(dataset, lookups[i].query, year, language, iterations, &matches);
+        printf("%s index lookup: %zu matches, %.3f ms\n", lookups[i].name, matches, elapsed * 1e3);
+    }
+}
+
+// Hardware events counted by the profiling harness
+#ifndef HAVE_PERF_EVENT
+#define PERF_TYPE_HARDWARE 0
+#define PERF_TYPE_HW_CACHE 0
+#define PERF_COUNT_HW_CPU_CYCLES 0
+#define PERF_COUNT_HW_INSTRUCTIONS 0
+#define PERF_COUNT_HW_CACHE_L1D 0
+#define PERF_COUNT_HW_CACHE_OP_READ 0
+#define PERF_COUNT_HW_CACHE_RESULT_MISS 0
+#define PERF_COUNT_HW_CACHE_MISSES 0
+#define PERF_COUNT_HW_BRANCH_MISSES 0
+#endif
+static const struct {
+    const char* name;
+    unsigned int type;
+    unsigned long long config;
+} profileEvents[] = {
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "L1D misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    { "LLC misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { "branch misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+#define PROFILE_EVENT_COUNT (int)(sizeof(profileEvents) / sizeof(profileEvents[0]))
+enum { EVENT_CYCLES, EVENT_INSTRUCTIONS, EVENT_L1D_MISSES, EVENT_LLC_MISSES, EVENT_BRANCH_MISSES };
+
+// Counters for the calling thread, one perf_event file descriptor per event
+typedef struct Profiler {
+    int fds[PROFILE_EVENT_COUNT];      // -1 when the event is not available
+    unsigned long long values[PROFILE_EVENT_COUNT];
+} Profiler;
+
+// Function to open the hardware counters of the calling thread (user space only)
+void openProfiler(Profiler* profiler) {
+    for (int i = 0; i < PROFILE_EVENT_COUNT; i++) {
+#ifndef HAVE_PERF_EVENT
+        profiler->fds[i] = -1;
+#else
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = profileEvents[i].type;
+        attr.config = profileEvents[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        profiler->fds[i] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+}
+
+// Function to close the counters of a profiler
+void closeProfiler(Profiler* profiler) {
+    for (int i = 0; i < PROFILE_EVENT_COUNT; i++) {
+        if (profiler->fds[i] >= 0) {
+            close(profiler->fds[i]);
+        }
+    }
+}
+
+// A stage measured by the harness; `context` is the shared ProfileInput
+typedef void (*ProfileStage)(void* context);
+
+// Function to run one stage with the counters enabled and print its per-row costs
+void profileStage(Profiler* profiler, const char* name, size_t rows, ProfileStage stage, void* context) {
+    for (int i = 0; i < PROFILE_EVENT_COUNT; i++) {
+        if (profiler->fds[i] >= 0) {
+#ifdef HAVE_PERF_EVENT
+            ioctl(profiler->fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(profiler->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+#endif
+        }
+    }
+    double start = nowSeconds();
+    stage(context);
+    double seconds = nowSeconds() - start;
+    for (int i = 0; i < PROFILE_EVENT_COUNT; i++) {
+        profiler->values[i] = 0;
+        if (profiler->fds[i] >= 0) {
+#ifdef HAVE_PERF_EVENT
+            ioctl(profiler->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+#endif
+            if (read(profiler->fds[i], &profiler->values[i], sizeof(profiler->values[i])) != sizeof(profiler->values[i])) {
+                profiler->values[i] = 0;
+            }
+        }
+    }
+
+    double perRow = rows > 0 ? 1.0 / rows : 0.0;
+    printf("%-36s %9.1f", name, seconds * 1e9 * perRow);
+    for (int i = 0; i < PROFILE_EVENT_COUNT; i++) {
+        if (profiler->fds[i] >= 0) {
+            printf(" %12.2f", profiler->values[i] * perRow);
+        } else {
+            printf(" %12s", "-");
+        }
+        if (i == EVENT_INSTRUCTIONS) {
+            if (profiler->fds[EVENT_CYCLES] >= 0 && profiler->fds[EVENT_INSTRUCTIONS] >= 0
+                && profiler->values[EVENT_CYCLES] > 0) {
+                printf(" %5.2f", (double)profiler->values[EVENT_INSTRUCTIONS] / profiler->values[EVENT_CYCLES]);
+            } else {
+                printf(" %5s", "-");
+            }
+        }
+    }
+    printf("\n");
+}
+
+// The input and intermediate results shared by the profiled stages. Every
+// stage works on the output of the previous one, so each measures only its own work.
+typedef struct ProfileInput {
+    char** lines;            // Data lines, NUL-terminated in place
+    size_t lineCount;
+    Schema schema;
+    ParsedRow* parsed;       // One per line
+    int* valid;              // Non-zero if the line parsed
+    Movie** nodes;           // One per valid line
+    size_t nodeCount;
+    Movie* baselineHead;     // The same nodes, each malloc'd and linked as the original loader did
+    Dataset dataset;
+    int year;                // Year and language the query stages look for
+    char language[256];
+    size_t matches;
+} ProfileInput;
+
+static void stageParse(void* context) {
+    ProfileInput* input = (ProfileInput*)context;
+    for (size_t i = 0; i < input->lineCount; i++) {
+        input->valid[i] = parseRow(&input->schema, input->lines[i], &input->parsed[i]) == NULL
+                          && input->parsed[i].titleLength < 256 && input->parsed[i].languagesLength < 256;
+    }
+}
+
+static void stageCreateMovieNode(void* context) {
+    ProfileInput* input = (ProfileInput*)context;
+    input->nodeCount = 0;
+    for (size_t i = 0; i < input->lineCount; i++) {
+        if (input->valid[i]) {
+            input->nodes[input->nodeCount++] = movieFromRow(&input->parsed[i]);
+        }
+    }
+}
+
+// Appending to the dataset, as a load does: the node is copied into the
+// dataset's movie storage, linked, and its row table, column and block
+// summary entries are filled in, growing them as needed
+static void stageAddMovieToDataset(void* context) {
+    ProfileInput* input = (ProfileInput*)context;
+    for (size_t i = 0; i < input->nodeCount; i++) {
+        Movie* node = newDatasetMovie(&input->dataset);
+        *node = *input->nodes[i];
+        addMovieToDataset(&input->dataset, node);
+    }
+}
+
+// Function to answer a query by walking a linked list, as the original program
+// did, returning the number of matches
+static size_t walkMovieList(Movie* head, RowPredicate predicate, const void* argument) {
+    ResultSet results = {0};
+    for (Movie* current = head; current != NULL; current = current->next) {
+        if (predicate(current, argument)) {
+            appendResult(&results, current);
+        }
+    }
+    size_t matches = results.count;
+    freeResults(&results);
+    return matches;
+}
+
+static void stageYearListWalk(void* context) {
+    ProfileInput* input = (ProfileInput*)context;
+    input->matches = walkMovieList(input->dataset.head, matchesYear, &input->year);
+}
+
+static void stageYearBaselineWalk(void* context) {
+    ProfileInput* input = (ProfileInput*)context;
+    input->matches = walkMovieList(input->baselineHead, matchesYear, &input->year);
+}
+
+static void stageYearRowScan(void* context) {
+    ProfileInput* input = (ProfileInput*)context;
+    ResultSet results = {0};
+    parallelScan(&input->dataset, matchesYear, NULL, &input->year, 1, &results);
+    input->matches = results.count;
+    freeResults(&results);
+}
+
+static void stageLanguageListWalk(void* context) {
+    ProfileInput* input = (ProfileInput*)context;
+    input->matches = walkMovieList(input->dataset.head, matchesLanguage, input->language);
+}
+
+static void stageLanguageBaselineWalk(void* context) {
+    ProfileInput* input = (ProfileInput*)context;
+    input->matches = walkMovieList(input->baselineHead, matchesLanguage, input->language);
+}
+
+static void stageLanguageRowScan(void* context) {
+    ProfileInput* input = (ProfileInput*)context;
+    ResultSet results = {0};
+    parallelScan(&input->dataset, matchesLanguage, NULL, input->language, 1, &results);
+    input->matches = results.count;
+    freeResults(&results);
+}
+
+static void stageYearBlockScan(void* context) {
+    ProfileInput* input = (ProfileInput*)context;
+    ResultSet results = {0};
+    parallelScan(&input->dataset, matchesYear, blockMayMatchYear, &input->year, 1, &results);
+    input->matches = results.count;
+    freeResults(&results);
+}
+
+static void stageLanguageBlockScan(void* context) {
+    ProfileInput* input = (ProfileInput*)context;
+    ResultSet results = {0};
+    parallelScan(&input->dataset, matchesLanguage, blockMayMatchLanguage, input->language, 1, &results);
+    input->matches = results.count;
+    freeResults(&results);
+}
+
+static void stageYearKernel(void* context) {
+    ProfileInput* input = (ProfileInput*)context;
+    ResultSet results = {0};
+    ScanFilter filter = { .useYear = 1, .minYear = input->year, .maxYear = input->year };
+    input->matches = filteredScan(&input->dataset, &filter, SINK_COLLECT, 1, &results);
+    freeResults(&results);
+}
+
+static void stageLanguageKernel(void* context) {
+    ProfileInput* input = (ProfileInput*)context;
+    ResultSet results = {0};
+    ScanFilter filter = { .useLanguage = 1, .language = input->language };
+    input->matches = filteredScan(&input->dataset, &filter, SINK_COLLECT, 1, &results);
+    freeResults(&results);
+}
+
+// The group-by engine before the index is built, the index lookup after
+static void stageBestPerYear(void* context) {
+    ProfileInput* input = (ProfileInput*)context;
+    ResultSet results = {0};
+    collectHighestRatedPerYear(&input->dataset, 1, &results);
+    input->matches = results.count;
+    freeResults(&results);
+}
+
+static void stageBuildIndex(void* context) {
+    buildDatasetIndex(&((ProfileInput*)context)->dataset);
+}
+
+static void stageYearIndex(void* context) {
+    ProfileInput* input = (ProfileInput*)context;
+    ResultSet results = {0};
+    collectMoviesByYear(&input->dataset, input->year, 1, &results);
+    input->matches = results.count;
+    freeResults(&results);
+}
+
+static void stageLanguageIndex(void* context) {
+    ProfileInput* input = (ProfileInput*)context;
+    ResultSet results = {0};
+    collectMoviesByLanguage(&input->dataset, input->language, 1, &results);
+    input->matches = results.count;
+    freeResults(&results);
+}
+
+// Function to read a whole input (decompressing it if needed) into memory
+static char* readWholeInput(const char* path, ReaderKind reader, size_t* size) {
+    BlockSource* source = openInputSource(path, reader);
+    if (source == NULL) {
+        return NULL;
     }
-    strncpy(newNode->title, title, sizeof(newNode->title) - 1);
-    newNode->title[sizeof(newNode->title) - 1] = '\0'; // Ensure null-termination
-    newNode->year = year;
+    size_t capacity = PIPELINE_BLOCK_SIZE;
+    size_t length = 0;
+    char* buffer = (char*)malloc(capacity + 1);
+    const char* data;
+    size_t blockLength;
+    int status;
+    while (buffer != NULL && (status = source->next(source, &data, &blockLength)) > 0) {
+        if (length + blockLength > capacity) {
+            while (length + blockLength > capacity) {
+                capacity *= 2;
+            }
+            char* grown = (char*)realloc(buffer, capacity + 1);
+            if (grown == NULL) {
+                free(buffer);
+                buffer = NULL;
+                break;
+            }
+            buffer = grown;
+        }
+        memcpy(buffer + length, data, blockLength);
+        length += blockLength;
+        source->release(source);
+    }
+    source->close(source);
+    if (buffer == NULL) {
+        perror("Failed to allocate memory for the input");
+        return NULL;
+    }
+    if (status < 0) {
+        perror("Error reading file");
+        free(buffer);
+        return NULL;
+    }
+    buffer[length] = '\0';
+    *size = length;
+    return buffer;
+}
 
-    // Remove square brackets from languages string if present
-    char cleaned_languages[256];
-    strncpy(cleaned_languages, languages, sizeof(cleaned_languages) - 1);
-    cleaned_languages[sizeof(cleaned_languages) - 1] = '\0';
+// Function to profile the hot paths on one input with the hardware counters:
+// the parse loop, createMovieNode, addMovieToDataset, each query as a walk of
+// the linked list (over malloc'd nodes as in the original program, and over
+// the dataset's chunked nodes), as scans of the row table and from the index
+int runProfile(const char* path, ReaderKind reader) {
+    size_t size = 0;
+    char* buffer = readWholeInput(path, reader, &size);
+    if (buffer == NULL) {
+        return -1;
+    }
 
-    if (cleaned_languages[0] == '[') {
-        size_t len = strlen(cleaned_languages);
-        if (len > 0 && cleaned_languages[len - 1] == ']') {
-            cleaned_languages[len - 1] = '\0'; // Remove ']'
-            // Use memmove to shift the string left, effectively removing the '['
-            memmove(cleaned_languages, cleaned_languages + 1, strlen(cleaned_languages + 1) + 1);
+    // Split the input into NUL-terminated lines outside of any measurement
+    ProfileInput input;
+    memset(&input, 0, sizeof(input));
+    size_t lineCapacity = 1024;
+    char** lines = (char**)malloc(lineCapacity * sizeof(char*));
+    size_t lineCount = 0;
+    for (char* cursor = buffer; lines != NULL && cursor < buffer + size;) {
+        char* newline = (char*)memchr(cursor, '\n', buffer + size - cursor);
+        char* end = newline != NULL ? newline : buffer + size;
+        *end = '\0';
+        if (end > cursor && end[-1] == '\r') {
+            end[-1] = '\0';
         }
+        if (lineCount == lineCapacity) {
+            lineCapacity *= 2;
+            lines = (char**)realloc(lines, lineCapacity * sizeof(char*));
+            if (lines == NULL) {
+                break;
+            }
+        }
+        lines[lineCount++] = cursor;
+        cursor = end + 1;
+    }
+    if (lines == NULL) {
+        perror("Failed to allocate memory for the input lines");
+        exit(EXIT_FAILURE);
+    }
+    if (lineCount == 0) {
+        fprintf(stderr, "Error reading header or empty file.\n");
+        free(lines);
+        free(buffer);
+        return -1;
+    }
+    const char* headerError = parseHeader(lines[0], &input.schema);
+    if (headerError != NULL) {
+        fprintf(stderr, "Error: %s: %s\n", headerError, lines[0]);
+        free(lines);
+        free(buffer);
+        return -1;
     }
-    strncpy(newNode->languages, cleaned_languages, sizeof(newNode->languages) - 1);
-    newNode->languages[sizeof(newNode->languages) - 1] = '\0'; // Ensure null-termination
 
-    newNode->rating = rating;
-    newNode->next = NULL;
-    return newNode;
+    input.lines = lines + 1;
+    input.lineCount = lineCount - 1;
+    input.parsed = (ParsedRow*)malloc((input.lineCount + 1) * sizeof(ParsedRow));
+    input.valid = (int*)malloc((input.lineCount + 1) * sizeof(int));
+    input.nodes = (Movie**)malloc((input.lineCount + 1) * sizeof(Movie*));
+    if (input.parsed == NULL || input.valid == NULL || input.nodes == NULL) {
+        perror("Failed to allocate memory for profiling");
+        exit(EXIT_FAILURE);
+    }
+
+    Profiler profiler;
+    openProfiler(&profiler);
+    int counters = 0;
+    for (int i = 0; i < PROFILE_EVENT_COUNT; i++) {
+        counters += profiler.fds[i] >= 0;
+    }
+    printf("Profile of %s: %zu lines, %d of %d hardware counters available\n",
+           path, input.lineCount, counters, PROFILE_EVENT_COUNT);
+    printf("%-36s %9s %12s %12s %5s %12s %12s %12s\n", "Stage (per row)", "ns", "cycles",
+           "instructions", "IPC", "L1D misses", "LLC misses", "br. misses");
+
+    profileStage(&profiler, "parse loop (parseRow)", input.lineCount, stageParse, &input);
+    profileStage(&profiler, "createMovieNode", input.lineCount, stageCreateMovieNode, &input);
+    profileStage(&profiler, "addMovieToDataset", input.nodeCount, stageAddMovieToDataset, &input);
+    // The dataset's nodes sit side by side in chunks; the ones createMovieNode
+    // allocated one at a time are kept as the original program's linked list
+    for (size_t i = input.nodeCount; i > 0; i--) {
+        input.nodes[i - 1]->next = input.baselineHead;
+        input.baselineHead = input.nodes[i - 1];
+    }
+
+    if (input.dataset.count > 0) {
+        input.year = input.dataset.rows[0]->year;
+        firstLanguageOf(input.dataset.rows[0], input.language, sizeof(input.language));
+        size_t rows = input.dataset.count;
+        profileStage(&profiler, "year query: baseline list walk", rows, stageYearBaselineWalk, &input);
+        profileStage(&profiler, "year query: linked list walk", rows, stageYearListWalk, &input);
+        profileStage(&profiler, "year query: row table scan", rows, stageYearRowScan, &input);
+        profileStage(&profiler, "year query: block-skipping scan", rows, stageYearBlockScan, &input);
+        profileStage(&profiler, "year query: specialized kernel", rows, stageYearKernel, &input);
+        profileStage(&profiler, "language query: baseline list walk", rows, stageLanguageBaselineWalk, &input);
+        profileStage(&profiler, "language query: linked list walk", rows, stageLanguageListWalk, &input);
+        profileStage(&profiler, "language query: row table scan", rows, stageLanguageRowScan, &input);
+        profileStage(&profiler, "language query: block-skipping scan", rows, stageLanguageBlockScan, &input);
+        profileStage(&profiler, "language query: specialized kernel", rows, stageLanguageKernel, &input);
+        profileStage(&profiler, "best per year: group-by engine", rows, stageBestPerYear, &input);
+        // The path menu options 1 to 3 take
+        profileStage(&profiler, "index build (buildDatasetIndex)", rows, stageBuildIndex, &input);
+        profileStage(&profiler, "year query: index lookup", rows, stageYearIndex, &input);
+        profileStage(&profiler, "language query: index lookup", rows, stageLanguageIndex, &input);
+        profileStage(&profiler, "best per year: index lookup", rows, stageBestPerYear, &input);
+    }
+
+    closeProfiler(&profiler);
+    for (size_t i = 0; i < input.nodeCount; i++) {
+        free(input.nodes[i]);
+    }
+    freeDataset(&input.dataset);
+    free(input.parsed);
+    free(input.valid);
+    free(input.nodes);
+    free(lines);
+    free(buffer);
+    return 0;
 }
 
-// Function to add a movie node to the end of the linked list
-void addMovieToList(Movie** head, Movie* newNode) {
-    if (*head == NULL) {
-        *head = newNode;
-    } else {
-        Movie* current = *head;
-        while (current->next != NULL) {
-            current = current->next;
+// A second CSV keyed by title and year, loaded to be joined with the movies.
+// Every other column holds numbers, such as box-office takings or view counts.
+typedef struct JoinInput {
+    char* buffer;          // The whole file; titles point into it
+    size_t rowCount;
+    const char** titles;
+    int* years;
+    double* values;        // rowCount x columnCount, NAN where a field is empty or not a number
+    size_t columnCount;
+    char columnNames[MAX_JOIN_COLUMNS][32];
+} JoinInput;
+
+// Function to split the next comma-separated field off `*cursor`, in place.
+// A field may be double-quoted, with "" standing for a quote inside it.
+static char* nextCsvField(char** cursor) {
+    char* field = *cursor;
+    if (*field != '"') {
+        char* end = field + strcspn(field, ",");
+        *cursor = *end == ',' ? end + 1 : end;
+        *end = '\0';
+        return field;
+    }
+    char* read = field + 1;
+    char* write = field;
+    while (*read != '\0') {
+        if (*read == '"' && read[1] == '"') {
+            *write++ = '"';
+            read += 2;
+        } else if (*read == '"') {
+            read++;
+            break;
+        } else {
+            *write++ = *read++;
         }
-        current->next = newNode;
     }
+    read += strcspn(read, ",");
+    *cursor = *read == ',' ? read + 1 : read;
+    *write = '\0';
+    return field;
 }
 
-// Function to print menu
-void printMenu() {
-    printf("\n1. Show movies released in the specified year\n");
-    printf("2. Show highest rated movie for each year\n");
-    printf("3. Show the title and year of release of all movies in a specific language\n");
-    printf("4. Exit from the program\n");
-    printf("\nEnter a choice from 1 to 4: ");
-}
+// Function to load a CSV to join with the movies. The header must name a
+// Title and a Year column; every other column becomes a joined column.
+// Returns 0 on success and -1 after printing an error.
+int loadJoinInput(const char* path, ReaderKind reader, JoinInput* input) {
+    memset(input, 0, sizeof(*input));
+    size_t size = 0;
+    input->buffer = readWholeInput(path, reader, &size);
+    if (input->buffer == NULL) {
+        return -1;
+    }
 
-// 1. Show movies released in the specified year
-void showMoviesByYear(Movie* head) {
-    int searchYear;
-    printf("Enter the year for which you want to see movies: ");
-    if (scanf("%d", &searchYear) != 1) {
-        printf("Invalid input. Please enter a number.\n");
-        while (getchar() != '\n'); // Clear input buffer
-        return;
+    char* cursor = input->buffer;
+    char* line = cursor;
+    cursor += strcspn(cursor, "\n");
+    if (*cursor == '\n') *cursor++ = '\0';
+    line[strcspn(line, "\r")] = '\0';
+
+    int titleField = -1;
+    int yearField = -1;
+    int columnField[MAX_COLUMNS];
+    int fieldCount = 0;
+    while (*line != '\0' || fieldCount == 0) {
+        if (fieldCount == MAX_COLUMNS) {
+            fprintf(stderr, "Error: %s has more than %d columns\n", path, MAX_COLUMNS);
+            return -1;
+        }
+        char* name = nextCsvField(&line);
+        columnField[fieldCount] = -1;
+        if (strcasecmp(name, "title") == 0) {
+            titleField = fieldCount;
+        } else if (strcasecmp(name, "year") == 0) {
+            yearField = fieldCount;
+        } else if (input->columnCount == MAX_JOIN_COLUMNS) {
+            fprintf(stderr, "Error: %s has more than %d columns to join\n", path, MAX_JOIN_COLUMNS);
+            return -1;
+        } else {
+            // Spaces become underscores so that a column name is one word on the command line
+            char* columnName = input->columnNames[input->columnCount];
+            snprintf(columnName, sizeof(input->columnNames[0]), "%s", name);
+            for (char* p = columnName; *p != '\0'; p++) {
+                if (*p == ' ') *p = '_';
+            }
+            columnField[fieldCount] = (int)input->columnCount++;
+        }
+        fieldCount++;
+    }
+    if (titleField < 0 || yearField < 0) {
+        fprintf(stderr, "Error: %s must have Title and Year columns to be joined\n", path);
+        return -1;
     }
 
-    Movie* current = head;
-    int found = 0;
-    while (current != NULL) {
-        if (current->year == searchYear) {
-            printf("%s\n", current->title);
-            found = 1;
+    size_t capacity = 1024;
+    input->titles = (const char**)malloc(capacity * sizeof(char*));
+    input->years = (int*)malloc(capacity * sizeof(int));
+    input->values = (double*)malloc(capacity * (input->columnCount + 1) * sizeof(double));
+    size_t skipped = 0;
+    while (*cursor != '\0') {
+        line = cursor;
+        cursor += strcspn(cursor, "\n");
+        if (*cursor == '\n') *cursor++ = '\0';
+        line[strcspn(line, "\r")] = '\0';
+        if (*line == '\0') {
+            continue;
+        }
+
+        if (input->rowCount == capacity) {
+            capacity *= 2;
+            input->titles = (const char**)realloc(input->titles, capacity * sizeof(char*));
+            input->years = (int*)realloc(input->years, capacity * sizeof(int));
+            input->values = (double*)realloc(input->values, capacity * (input->columnCount + 1) * sizeof(double));
+        }
+        if (input->titles == NULL || input->years == NULL || input->values == NULL) {
+            perror("Failed to allocate memory for the joined rows");
+            exit(EXIT_FAILURE);
+        }
+
+        size_t row = input->rowCount;
+        double* values = &input->values[row * input->columnCount];
+        const char* title = NULL;
+        char* yearEnd = NULL;
+        int field = 0;
+        for (; field < fieldCount && (*line != '\0' || field == fieldCount - 1); field++) {
+            char* value = nextCsvField(&line);
+            if (field == titleField) {
+                title = value;
+            } else if (field == yearField) {
+                input->years[row] = (int)strtol(value, &yearEnd, 10);
+                if (yearEnd == value || *yearEnd != '\0') {
+                    yearEnd = NULL;
+                }
+            } else {
+                char* end;
+                double number = strtod(value, &end);
+                values[columnField[field]] = end != value && *end == '\0' ? number : NAN;
+            }
+        }
+        if (field != fieldCount || *line != '\0' || title == NULL || yearEnd == NULL) {
+            skipped++;
+            continue;
         }
-        current = current->next;
+        input->titles[row] = title;
+        input->rowCount++;
     }
-    if (!found) {
-        printf("No data about movies released in the year %d\n", searchYear);
+    if (skipped > 0) {
+        fprintf(stderr, "Skipped %zu malformed rows of %s\n", skipped, path);
     }
+    return 0;
 }
 
-// 2. Show highest rated movie for each year
-void showHighestRatedMoviePerYear(Movie* head) {
-    // A temporary linked list to store the highest rated movie for each year
-    typedef struct YearRating {
-        int year;
-        float highestRating;
-        char title[256];
-        struct YearRating *next;
-    } YearRating;
-
-    YearRating* yearRatingsHead = NULL;
-
-    Movie* currentMovie = head;
-    while (currentMovie != NULL) {
-        YearRating* currentYearRating = yearRatingsHead;
-        int foundYear = 0;
-        while (currentYearRating != NULL) {
-            if (currentYearRating->year == currentMovie->year) {
-                foundYear = 1;
-                if (currentMovie->rating > currentYearRating->highestRating) {
-                    currentYearRating->highestRating = currentMovie->rating;
-                    strncpy(currentYearRating->title, currentMovie->title, sizeof(currentYearRating->title) - 1);
-                    currentYearRating->title[sizeof(currentYearRating->title) - 1] = '\0';
+// Function to free a loaded join input
+void freeJoinInput(JoinInput* input) {
+    free(input->buffer);
+    free(input->titles);
+    free(input->years);
+    free(input->values);
+    memset(input, 0, sizeof(*input));
+}
+
+// Function to hash a join key
+static unsigned long long joinKeyHash(const char* title, int year) {
+    return hashBytes(title, strlen(title)) ^ ((unsigned long long)(unsigned int)year * 0x9E3779B97F4A7C15ULL);
+}
+
+// Open-addressing hash table over the rows of the build side of a join.
+// Slots hold row + 1, with 0 marking an empty slot.
+typedef struct JoinTable {
+    size_t* slots;
+    unsigned long long* hashes;
+    size_t mask;
+} JoinTable;
+
+// Function to create an empty join table for `rows` rows
+static void initJoinTable(JoinTable* table, size_t rows) {
+    size_t capacity = 16;
+    while (capacity < rows * 2) {
+        capacity *= 2;
+    }
+    table->slots = (size_t*)calloc(capacity, sizeof(size_t));
+    table->hashes = (unsigned long long*)malloc(capacity * sizeof(unsigned long long));
+    if (table->slots == NULL || table->hashes == NULL) {
+        perror("Failed to allocate memory for the join table");
+        exit(EXIT_FAILURE);
+    }
+    table->mask = capacity - 1;
+}
+
+// The work of one probe thread: rows [begin, end) of the probe side
+typedef struct JoinPartition {
+    Dataset* dataset;
+    const JoinInput* input;
+    const JoinTable* table;
+    size_t begin;
+    size_t end;
+    size_t* matchedRow;    // Build on the movies: earliest joined row matching each movie
+    size_t matches;
+} JoinPartition;
+
+// Function run by each probe thread when the table holds the joined rows:
+// look up every movie in the range and copy the values of its match
+static void* probeWithMovies(void* arg) {
+    JoinPartition* partition = (JoinPartition*)arg;
+    Dataset* dataset = partition->dataset;
+    const JoinInput* input = partition->input;
+    const JoinTable* table = partition->table;
+    for (size_t i = partition->begin; i < partition->end; i++) {
+        if (dataset->deleted[i]) {
+            continue;
+        }
+        const Movie* movie = dataset->rows[i];
+        const char* title = movieTitle(movie);
+        unsigned long long hash = joinKeyHash(title, movie->year);
+        for (size_t slot = hash & table->mask; table->slots[slot] != 0; slot = (slot + 1) & table->mask) {
+            size_t row = table->slots[slot] - 1;
+            if (table->hashes[slot] == hash && input->years[row] == movie->year
+                && strcmp(input->titles[row], title) == 0) {
+                for (size_t c = 0; c < input->columnCount; c++) {
+                    dataset->joinValues[c][i] = input->values[row * input->columnCount + c];
                 }
+                partition->matches++;
                 break;
             }
-            currentYearRating = currentYearRating->next;
         }
+    }
+    return NULL;
+}
 
-        if (!foundYear) {
-            // Add new year to the list
-            YearRating* newYearRating = (YearRating*)malloc(sizeof(YearRating));
-            if (newYearRating == NULL) {
-                perror("Failed to allocate memory for year rating node");
-                exit(EXIT_FAILURE);
+// Function run by each probe thread when the table holds the movies: look up
+// every joined row in the range and record it against each movie it matches,
+// keeping the earliest joined row when several match one movie
+static void* probeWithJoinedRows(void* arg) {
+    JoinPartition* partition = (JoinPartition*)arg;
+    const Dataset* dataset = partition->dataset;
+    const JoinInput* input = partition->input;
+    const JoinTable* table = partition->table;
+    for (size_t row = partition->begin; row < partition->end; row++) {
+        unsigned long long hash = joinKeyHash(input->titles[row], input->years[row]);
+        for (size_t slot = hash & table->mask; table->slots[slot] != 0; slot = (slot + 1) & table->mask) {
+            size_t i = table->slots[slot] - 1;
+            if (table->hashes[slot] == hash && dataset->rows[i]->year == input->years[row]
+                && strcmp(movieTitle(dataset->rows[i]), input->titles[row]) == 0) {
+                size_t current = __atomic_load_n(&partition->matchedRow[i], __ATOMIC_RELAXED);
+                while (row < current
+                       && !__atomic_compare_exchange_n(&partition->matchedRow[i], &current, row, 0,
+                                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                }
             }
-            newYearRating->year = currentMovie->year;
-            newYearRating->highestRating = currentMovie->rating;
-            strncpy(newYearRating->title, currentMovie->title, sizeof(newYearRating->title) - 1);
-            newYearRating->title[sizeof(newYearRating->title) - 1] = '\0';
-            newYearRating->next = NULL;
+        }
+    }
+    return NULL;
+}
 
-            if (yearRatingsHead == NULL) {
-                yearRatingsHead = newYearRating;
-            } else {
-                YearRating* temp = yearRatingsHead;
-                while (temp->next != NULL) {
-                    temp = temp->next;
-                }
-                temp->next = newYearRating;
+// Function to left-join the movies with a second CSV on title and year. The
+// hash table is built on the smaller side and the larger side probes it with
+// up to `workers` threads. Each column of the CSV becomes a joined column of
+// the dataset, NAN for movies without a match. Returns the number of movies
+// that found a match.
+size_t joinDataset(Dataset* dataset, const JoinInput* input, int workers) {
+    for (size_t c = 0; c < dataset->joinColumnCount; c++) {
+        freeColumn(dataset->joinValues[c], dataset->capacity * sizeof(double));
+    }
+    dataset->joinColumnCount = input->columnCount;
+    for (size_t c = 0; c < input->columnCount; c++) {
+        memcpy(dataset->joinColumnNames[c], input->columnNames[c], sizeof(dataset->joinColumnNames[c]));
+        dataset->joinValues[c] = (double*)allocateColumn(dataset->capacity * sizeof(double));
+        if (dataset->joinValues[c] == NULL) {
+            perror("Failed to allocate memory for a joined column");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < dataset->count; i++) {
+            dataset->joinValues[c][i] = NAN;
+        }
+    }
+    dataset->generation++;
+
+    size_t liveMovies = dataset->count - dataset->deletedCount;
+    int buildOnMovies = liveMovies < input->rowCount;
+    size_t probeRows = buildOnMovies ? input->rowCount : dataset->count;
+
+    // Build: insert the rows of the smaller side. Joined rows with a key seen
+    // before are left out, so the first of them is the one that matches.
+    JoinTable table;
+    initJoinTable(&table, buildOnMovies ? liveMovies : input->rowCount);
+    size_t buildRows = buildOnMovies ? dataset->count : input->rowCount;
+    for (size_t row = 0; row < buildRows; row++) {
+        const char* title;
+        int year;
+        if (buildOnMovies) {
+            if (dataset->deleted[row]) {
+                continue;
+            }
+            title = movieTitle(dataset->rows[row]);
+            year = dataset->rows[row]->year;
+        } else {
+            title = input->titles[row];
+            year = input->years[row];
+        }
+        unsigned long long hash = joinKeyHash(title, year);
+        size_t slot = hash & table.mask;
+        int duplicate = 0;
+        for (; table.slots[slot] != 0; slot = (slot + 1) & table.mask) {
+            size_t other = table.slots[slot] - 1;
+            if (!buildOnMovies && table.hashes[slot] == hash && input->years[other] == year
+                && strcmp(input->titles[other], title) == 0) {
+                duplicate = 1;
+                break;
             }
         }
-        currentMovie = currentMovie->next;
+        if (!duplicate) {
+            table.slots[slot] = row + 1;
+            table.hashes[slot] = hash;
+        }
+    }
+
+    size_t* matchedRow = NULL;
+    if (buildOnMovies) {
+        matchedRow = (size_t*)malloc((dataset->count + 1) * sizeof(size_t));
+        if (matchedRow == NULL) {
+            perror("Failed to allocate memory for the join");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < dataset->count; i++) {
+            matchedRow[i] = SIZE_MAX;
+        }
     }
 
-    // Print the results
-    YearRating* tempYearRating = yearRatingsHead;
-    while (tempYearRating != NULL) {
-        printf("%d %.1f %s\n", tempYearRating->year, tempYearRating->highestRating, tempYearRating->title);
-        tempYearRating = tempYearRating->next;
+    // Probe: the larger side is split into contiguous ranges, one per thread
+    size_t maxWorkers = probeRows / MIN_ROWS_PER_WORKER;
+    size_t workerCount = workers > 1 ? (size_t)workers : 1;
+    if (workerCount > maxWorkers) {
+        workerCount = maxWorkers > 0 ? maxWorkers : 1;
+    }
+    JoinPartition* partitions = (JoinPartition*)calloc(workerCount, sizeof(JoinPartition));
+    pthread_t* threads = (pthread_t*)malloc(workerCount * sizeof(pthread_t));
+    if (partitions == NULL || threads == NULL) {
+        perror("Failed to allocate memory for join workers");
+        exit(EXIT_FAILURE);
+    }
+    void* (*probe)(void*) = buildOnMovies ? probeWithJoinedRows : probeWithMovies;
+    for (size_t w = 0; w < workerCount; w++) {
+        partitions[w].dataset = dataset;
+        partitions[w].input = input;
+        partitions[w].table = &table;
+        partitions[w].begin = probeRows * w / workerCount;
+        partitions[w].end = probeRows * (w + 1) / workerCount;
+        partitions[w].matchedRow = matchedRow;
+    }
+    for (size_t w = 1; w < workerCount; w++) {
+        if (pthread_create(&threads[w], NULL, probe, &partitions[w]) != 0) {
+            perror("Failed to start join worker");
+            exit(EXIT_FAILURE);
+        }
+    }
+    probe(&partitions[0]);
+    for (size_t w = 1; w < workerCount; w++) {
+        pthread_join(threads[w], NULL);
     }
 
-    // Free the temporary YearRating linked list
-    YearRating* currentYR = yearRatingsHead;
-    YearRating* nextYR;
-    while (currentYR != NULL) {
-        nextYR = currentYR->next;
-        free(currentYR);
-        currentYR = nextYR;
+    size_t matches = 0;
+    for (size_t w = 0; w < workerCount; w++) {
+        matches += partitions[w].matches;
+    }
+    if (buildOnMovies) {
+        for (size_t i = 0; i < dataset->count; i++) {
+            if (matchedRow[i] == SIZE_MAX) {
+                continue;
+            }
+            for (size_t c = 0; c < input->columnCount; c++) {
+                dataset->joinValues[c][i] = input->values[matchedRow[i] * input->columnCount + c];
+            }
+            matches++;
+        }
     }
+
+    free(matchedRow);
+    free(partitions);
+    free(threads);
+    free(table.slots);
+    free(table.hashes);
+    return matches;
 }
 
+// Layout version of a shared dataset segment. Bump it whenever SharedHeader
+// or the layout of the sections after it changes.
+#define SHARED_FORMAT_VERSION 2
+#define SHARED_MAGIC "MOVIESHM"
 
-// 3. Show the title and year of release of all movies in a specific language
-void showMoviesByLanguage(Movie* head) {
-    char searchTerm[256];
-    char orginalTerm[256];
-    printf("Enter the language for which you want to see movies: ");
-    getchar(); // Consume the newline character left by previous input
-    fgets(orginalTerm, sizeof(orginalTerm), stdin);
-    orginalTerm[strcspn(orginalTerm, "\n")] = '\0'; // Remove trailing newline
+// States of a segment; processes only attach to a ready one
+#define SHARED_BUILDING 0
+#define SHARED_READY 1
 
-    // Convert search term to lowercase for case-insensitive comparison
-    for (int i = 0; orginalTerm[i]; i++) {
-        searchTerm[i] = tolower(orginalTerm[i]);
-    }
+// Every section of a segment starts on a cache line
+#define SHARED_ALIGNMENT 64
 
-    Movie* current = head;
-    int found = 0;
-    while (current != NULL) {
-        // Create a modifiable copy of languages string for tokenization
-        char languagesCopy[256];
-        strncpy(languagesCopy, current->languages, sizeof(languagesCopy) - 1);
-        languagesCopy[sizeof(languagesCopy) - 1] = '\0';
+// One movie in a shared dataset segment. It holds only fixed-size values and no
+// pointers, so a record reads the same in every process and build.
+typedef struct SharedMovie {
+    char title[256];
+    char languages[256];            // Semicolon-separated, without brackets
+    int year;
+    float rating;
+    unsigned short titleLength;
+    unsigned short languagesLength;
+} SharedMovie;
 
-        char* token = strtok(languagesCopy, ";");
-        while (token != NULL) {
-            // Trim leading/trailing spaces from token
-            while (*token == ' ') token++;
-            char* end = token + strlen(token) - 1;
-            while (end > token && *end == ' ') end--;
-            *(end + 1) = '\0';
+// Header at the start of a shared dataset segment. Every position in the
+// segment is an offset from its start, so the segment means the same in every
+// process whatever address it is mapped at.
+typedef struct SharedHeader {
+    char magic[8];
+    unsigned int formatVersion;
+    unsigned int state;              // SHARED_BUILDING until the builder is done
+    unsigned long long generation;   // 1 for the first build, one more for each refresh
+    unsigned int movieSize;          // sizeof(SharedMovie) and sizeof(BlockSummary) of the
+    unsigned int blockSummarySize;   // builder, so another build refuses the layout
+    unsigned long long totalSize;
 
-            char tokenLower[256];
-            strncpy(tokenLower, token, sizeof(tokenLower) - 1);
-            tokenLower[sizeof(tokenLower) - 1] = '\0';
-            for (int i = 0; tokenLower[i]; i++) {
-                tokenLower[i] = tolower(tokenLower[i]);
-            }
+    // The CSV the segment was built from; when any of these change it is stale
+    unsigned long long sourceDevice;
+    unsigned long long sourceInode;
+    unsigned long long sourceSize;
+    long long sourceModifiedSeconds;
+    long long sourceModifiedNanoseconds;
 
-            if (strcmp(tokenLower, searchTerm) == 0) {
-                printf("%d %s\n", current->year, current->title);
-                found = 1;
-                break; // Found the language, no need to check other languages for this movie
-            }
-            token = strtok(NULL, ";");
+    unsigned long long count;
+    unsigned long long blockCount;
+    unsigned long long moviesOffset; // count SharedMovie records, in row order
+    unsigned long long yearsOffset;
+    unsigned long long ratingsOffset;
+    unsigned long long deletedOffset;
+    unsigned long long blocksOffset;
+    unsigned long long cubeOffset;   // 0 when the builder had no cube
+    int cubeFirstYear;
+    int cubeYearCount;
+    int cubeFirstTenth;
+    int cubeTenthCount;
+} SharedHeader;
+
+// Function to round a section size up to SHARED_ALIGNMENT
+static size_t sharedAlign(size_t size) {
+    return (size + SHARED_ALIGNMENT - 1) & ~(size_t)(SHARED_ALIGNMENT - 1);
+}
+
+// Function to check that a section lies inside a segment
+static int sharedSectionFits(const SharedHeader* header, unsigned long long offset, unsigned long long length) {
+    return offset >= sizeof(SharedHeader) && offset <= header->totalSize
+           && length <= header->totalSize - offset;
+}
+
+// Function to check that a mapped segment is ready, has this build's layout
+// and was built from the CSV as it is now
+static int sharedSegmentUsable(const SharedHeader* header, size_t size, const struct stat* source) {
+    if (memcmp(header->magic, SHARED_MAGIC, sizeof(header->magic)) != 0
+        || header->formatVersion != SHARED_FORMAT_VERSION
+        || __atomic_load_n(&header->state, __ATOMIC_ACQUIRE) != SHARED_READY
+        || header->movieSize != sizeof(SharedMovie) || header->blockSummarySize != sizeof(BlockSummary)
+        || header->totalSize != size) {
+        return 0;
+    }
+    if (header->sourceDevice != (unsigned long long)source->st_dev
+        || header->sourceInode != (unsigned long long)source->st_ino
+        || header->sourceSize != (unsigned long long)source->st_size
+        || header->sourceModifiedSeconds != (long long)source->st_mtim.tv_sec
+        || header->sourceModifiedNanoseconds != (long long)source->st_mtim.tv_nsec) {
+        return 0;
+    }
+    unsigned long long count = header->count;
+    unsigned long long cubeCells = (unsigned long long)(header->cubeYearCount + 1) * (header->cubeTenthCount + 1);
+    return header->blockCount == (count + ROW_BLOCK_SIZE - 1) / ROW_BLOCK_SIZE
+           && sharedSectionFits(header, header->moviesOffset, count * sizeof(SharedMovie))
+           && sharedSectionFits(header, header->yearsOffset, count * sizeof(int))
+           && sharedSectionFits(header, header->ratingsOffset, count * sizeof(float))
+           && sharedSectionFits(header, header->deletedOffset, count)
+           && sharedSectionFits(header, header->blocksOffset, header->blockCount * sizeof(BlockSummary))
+           && (header->cubeOffset == 0
+               || sharedSectionFits(header, header->cubeOffset, cubeCells * sizeof(unsigned int)));
+}
+
+// Function to attach to the shared dataset segment `name` read-only. Only the
+// row table and its movie nodes are built, as lazy nodes whose title and
+// languages are decoded from the segment's records on first use; everything
+// else is used where it lies in the segment.
+// Returns the number of movies, or -1 if there is no ready segment built from
+// the CSV at `csvPath` as it is now.
+int attachSharedDataset(const char* name, const char* csvPath, Dataset* dataset) {
+    struct stat source;
+    if (stat(csvPath, &source) != 0) {
+        return -1;
+    }
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(SharedHeader)) {
+        close(fd); // Missing, or still being sized by its builder
+        return -1;
+    }
+    char* segment = (char*)mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED) {
+        return -1;
+    }
+    const SharedHeader* header = (const SharedHeader*)segment;
+    if (!sharedSegmentUsable(header, info.st_size, &source)) {
+        munmap(segment, info.st_size);
+        return -1;
+    }
+
+    size_t count = header->count;
+    const SharedMovie* records = (const SharedMovie*)(segment + header->moviesOffset);
+    dataset->rows = (Movie**)allocateColumn(count * sizeof(Movie*));
+    if (dataset->rows == NULL) {
+        perror("Failed to allocate memory for the row table");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < count; i++) {
+        const SharedMovie* record = &records[i];
+        dataset->count = i; // Numbers the chunks newDatasetMovie starts
+        Movie* movie = newDatasetMovie(dataset);
+        initLazyMovieNode(movie, segment, (const char*)record->title - segment, record->titleLength,
+                          (const char*)record->languages - segment, record->languagesLength,
+                          record->year, record->rating);
+        movie->rowId = i;
+        dataset->rows[i] = movie;
+    }
+    if (header->cubeOffset != 0) {
+        dataset->cube = (RatingCube*)malloc(sizeof(RatingCube));
+        if (dataset->cube == NULL) {
+            perror("Failed to allocate memory for the rating cube");
+            exit(EXIT_FAILURE);
         }
-        current = current->next;
+        dataset->cube->firstYear = header->cubeFirstYear;
+        dataset->cube->yearCount = header->cubeYearCount;
+        dataset->cube->firstTenth = header->cubeFirstTenth;
+        dataset->cube->tenthCount = header->cubeTenthCount;
+        dataset->cube->cells = (unsigned int*)(segment + header->cubeOffset);
     }
-    if (!found) {
-        printf("No data about movies released in %s\n", orginalTerm);
+    dataset->years = (int*)(segment + header->yearsOffset);
+    dataset->ratings = (float*)(segment + header->ratingsOffset);
+    dataset->deleted = (unsigned char*)(segment + header->deletedOffset);
+    dataset->blocks = (BlockSummary*)(segment + header->blocksOffset);
+    dataset->count = dataset->capacity = count;
+    dataset->blockCount = header->blockCount;
+    dataset->sharedSegment = segment;
+    dataset->sharedSize = info.st_size;
+    dataset->generation = header->generation;
+    return (int)count;
+}
+
+// Function to take the builder lock of the shared dataset `name`, waiting
+// while another process holds it. Returns the descriptor that holds the lock,
+// or -1 on error. Closing the descriptor, or exiting, releases the lock.
+int lockSharedBuilder(const char* name) {
+    char lockName[NAME_MAX + 8];
+    snprintf(lockName, sizeof(lockName), "%s.lock", name);
+    int fd = shm_open(lockName, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        perror("Failed to open the shared dataset lock");
+        return -1;
+    }
+    struct flock lock = {0};
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET; // Start 0 and length 0 lock the whole object
+    while (fcntl(fd, F_SETLKW, &lock) != 0) {
+        if (errno != EINTR) {
+            perror("Failed to lock the shared dataset");
+            close(fd);
+            return -1;
+        }
     }
+    return fd;
 }
 
-// Function to free the linked list memory
-void freeMovieList(Movie* head) {
-    Movie* current = head;
-    Movie* next;
-    while (current != NULL) {
-        next = current->next;
-        free(current);
-        current = next;
+// Function to publish a loaded dataset as the shared segment `name`, replacing
+// any older one. The caller must hold the builder lock. The segment is filled
+// under the name in the SHARED_BUILDING state and marked ready last; processes
+// still attached to the segment it replaces keep their mapping of it.
+// Returns 0 on success or -1 on error.
+int publishSharedDataset(const char* name, const char* csvPath, Dataset* dataset) {
+    struct stat source;
+    if (stat(csvPath, &source) != 0) {
+        perror("Error reading file size");
+        return -1;
+    }
+    if (dataset->cube == NULL) {
+        buildRatingCube(dataset);
+    }
+    const RatingCube* cube = dataset->cube;
+    size_t count = dataset->count;
+    size_t cubeCells = cube != NULL ? (size_t)(cube->yearCount + 1) * (cube->tenthCount + 1) : 0;
+
+    SharedHeader layout = {0};
+    size_t size = sharedAlign(sizeof(SharedHeader));
+    layout.moviesOffset = size;
+    size += sharedAlign(count * sizeof(SharedMovie));
+    layout.yearsOffset = size;
+    size += sharedAlign(count * sizeof(int));
+    layout.ratingsOffset = size;
+    size += sharedAlign(count * sizeof(float));
+    layout.deletedOffset = size;
+    size += sharedAlign(count);
+    layout.blocksOffset = size;
+    size += sharedAlign(dataset->blockCount * sizeof(BlockSummary));
+    if (cube != NULL) {
+        layout.cubeOffset = size;
+        size += sharedAlign(cubeCells * sizeof(unsigned int));
+    }
+
+    // The generation carries on from the segment being replaced
+    unsigned long long generation = 1;
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd >= 0) {
+        SharedHeader old;
+        if (pread(fd, &old, sizeof(old), 0) == (ssize_t)sizeof(old)
+            && memcmp(old.magic, SHARED_MAGIC, sizeof(old.magic)) == 0) {
+            generation = old.generation + 1;
+        }
+        close(fd);
+    }
+    shm_unlink(name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        perror("Failed to create the shared dataset");
+        return -1;
+    }
+    // Reserve the pages now, so a full /dev/shm fails here and not with SIGBUS while filling
+    int error = posix_fallocate(fd, 0, size);
+    if (error != 0) {
+        errno = error;
+        perror("Failed to size the shared dataset");
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+    char* segment = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED) {
+        perror("Failed to map the shared dataset");
+        shm_unlink(name);
+        return -1;
+    }
+
+    // The new object is zero-filled, so its state is SHARED_BUILDING until the end
+    SharedHeader* header = (SharedHeader*)segment;
+    *header = layout;
+    memcpy(header->magic, SHARED_MAGIC, sizeof(header->magic));
+    header->formatVersion = SHARED_FORMAT_VERSION;
+    header->generation = generation;
+    header->movieSize = sizeof(SharedMovie);
+    header->blockSummarySize = sizeof(BlockSummary);
+    header->totalSize = size;
+    header->sourceDevice = source.st_dev;
+    header->sourceInode = source.st_ino;
+    header->sourceSize = source.st_size;
+    header->sourceModifiedSeconds = source.st_mtim.tv_sec;
+    header->sourceModifiedNanoseconds = source.st_mtim.tv_nsec;
+    header->count = count;
+    header->blockCount = dataset->blockCount;
+
+    // Movies are stored fully decoded, in row order
+    SharedMovie* records = (SharedMovie*)(segment + layout.moviesOffset);
+    for (size_t i = 0; i < count; i++) {
+        const Movie* movie = dataset->rows[i];
+        SharedMovie* record = &records[i];
+        record->titleLength = (unsigned short)strlen(movieTitle(movie));
+        record->languagesLength = (unsigned short)strlen(movieLanguages(movie));
+        memcpy(record->title, movie->title, record->titleLength + 1);
+        memcpy(record->languages, movie->languages, record->languagesLength + 1);
+        record->year = movie->year;
+        record->rating = movie->rating;
+    }
+    memcpy(segment + layout.yearsOffset, dataset->years, count * sizeof(int));
+    memcpy(segment + layout.ratingsOffset, dataset->ratings, count * sizeof(float));
+    memcpy(segment + layout.deletedOffset, dataset->deleted, count);
+    memcpy(segment + layout.blocksOffset, dataset->blocks, dataset->blockCount * sizeof(BlockSummary));
+    if (cube != NULL) {
+        header->cubeFirstYear = cube->firstYear;
+        header->cubeYearCount = cube->yearCount;
+        header->cubeFirstTenth = cube->firstTenth;
+        header->cubeTenthCount = cube->tenthCount;
+        memcpy(segment + layout.cubeOffset, cube->cells, cubeCells * sizeof(unsigned int));
     }
+
+    __atomic_store_n(&header->state, SHARED_READY, __ATOMIC_RELEASE);
+    munmap(segment, size);
+    return 0;
+}
+
+// Function to print command line usage
+void printUsage(const char* program) {
+    fprintf(stderr, "Usage: %s [--sort=year|rating|COLUMN] [--desc] [--workers=N] [--bench] [--lazy]\n"
+            "       [--reader=uring|pread] [--cache-mb=N] [--stats] [--profile] [--join=CSV]\n"
+            "       [--quarantine=FILE] [--shared=NAME] [--batch=FILE]\n"
+            "       [--query=year:Y|language:L|best-per-year] <csv_file_path>\n", program);
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <csv_file_path>\n", argv[0]);
-        return EXIT_FAILURE;
+    QueryOptions options = { SORT_NONE, 0, 1, NULL, 0 };
+    const char* csvPath = NULL;
+    int benchmark = 0;
+    int lazy = 0;
+    ReaderKind reader = READER_AUTO;
+    size_t cacheMegabytes = 16;
+    int statistics = 0;
+    int profile = 0;
+    const char* streamQuery = NULL;
+    const char* joinPath = NULL;
+    const char* quarantinePath = NULL;
+    const char* batchPath = NULL;
+    char sharedName[NAME_MAX] = "";
+
+    long onlineCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (onlineCpus > 1) {
+        options.workers = (int)onlineCpus;
     }
 
-    FILE *file = fopen(argv[1], "r");
-    if (file == NULL) {
-        perror("Error opening file");
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--sort=year") == 0) {
+            options.sortKey = SORT_YEAR;
+        } else if (strcmp(argv[i], "--sort=rating") == 0) {
+            options.sortKey = SORT_RATING;
+        } else if (strcmp(argv[i], "--sort=none") == 0) {
+            options.sortKey = SORT_NONE;
+        } else if (strncmp(argv[i], "--sort=", 7) == 0) {
+            // Any other key names a joined column, checked once the join is loaded
+            options.sortKey = SORT_JOINED;
+            options.sortColumnName = argv[i] + 7;
+        } else if (strncmp(argv[i], "--quarantine=", 13) == 0) {
+            quarantinePath = argv[i] + 13;
+        } else if (strncmp(argv[i], "--shared=", 9) == 0) {
+            // Shared-memory object names are a single component with a leading slash
+            const char* name = argv[i] + 9;
+            name += name[0] == '/';
+            if (name[0] == '\0' || strchr(name, '/') != NULL || strlen(name) + 6 >= sizeof(sharedName)) {
+                fprintf(stderr, "Invalid shared dataset name: %s\n", argv[i] + 9);
+                return EXIT_FAILURE;
+            }
+            snprintf(sharedName, sizeof(sharedName), "/%s", name);
+        } else if (strncmp(argv[i], "--batch=", 8) == 0) {
+            batchPath = argv[i] + 8;
+        } else if (strncmp(argv[i], "--join=", 7) == 0) {
+            joinPath = argv[i] + 7;
+        } else if (strcmp(argv[i], "--desc") == 0) {
+            options.descending = 1;
+        } else if (strncmp(argv[i], "--workers=", 10) == 0) {
+            const char* value = argv[i] + 10;
+            char* end;
+            errno = 0;
+            long workers = strtol(value, &end, 10);
+            if (!isdigit((unsigned char)value[0]) || *end != '\0' || errno == ERANGE
+                || workers < 1 || workers > INT_MAX) {
+                fprintf(stderr, "Invalid worker count: %s\n", value);
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            options.workers = (int)workers;
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            benchmark = 1;
+        } else if (strncmp(argv[i], "--query=", 8) == 0) {
+            streamQuery = argv[i] + 8;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            profile = 1;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            statistics = 1;
+        } else if (strcmp(argv[i], "--lazy") == 0) {
+            lazy = 1;
+        } else if (strncmp(argv[i], "--cache-mb=", 11) == 0) {
+            const char* value = argv[i] + 11;
+            char* end;
+            errno = 0;
+            unsigned long megabytes = strtoul(value, &end, 10);
+            // The budget is kept in bytes, so it must fit in a size_t once shifted
+            if (!isdigit((unsigned char)value[0]) || *end != '\0' || errno == ERANGE
+                || megabytes > SIZE_MAX >> 20) {
+                fprintf(stderr, "Invalid cache size: %s\n", value);
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            cacheMegabytes = megabytes;
+        } else if (strcmp(argv[i], "--reader=uring") == 0) {
+            reader = READER_URING;
+        } else if (strcmp(argv[i], "--reader=pread") == 0) {
+            reader = READER_PREAD;
+        } else if (argv[i][0] == '-' && argv[i][1] == '-') {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        } else if (csvPath == NULL) {
+            csvPath = argv[i];
+        } else {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (csvPath == NULL) {
+        printUsage(argv[0]);
         return EXIT_FAILURE;
     }
-
-    Movie* head = NULL;
-    char line[1024]; // Assuming max line length
-    int movieCount = 0;
-    
-    // Read and discard the header line
-    if (fgets(line, sizeof(line), file) == NULL) {
-        fprintf(stderr, "Error reading header or empty file.\n");
-        fclose(file);
+    if (options.sortKey == SORT_JOINED && (joinPath == NULL || streamQuery != NULL)) {
+        fprintf(stderr, "Unknown sort key: %s\n", options.sortColumnName);
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (quarantinePath != NULL && profile) {
+        // The profiler times its own loads and reports no rejected lines
+        fprintf(stderr, "--quarantine cannot be used with --profile\n");
+        printUsage(argv[0]);
         return EXIT_FAILURE;
     }
 
-    while (fgets(line, sizeof(line), file) != NULL) {
-        // Remove trailing newline character if present
-        line[strcspn(line, "\n")] = '\0';
+    // Rejected lines are counted in every mode that parses the file, and kept if asked
+    Quarantine quarantine = {0};
+    if (quarantinePath != NULL && openQuarantine(&quarantine, quarantinePath) != 0) {
+        return EXIT_FAILURE;
+    }
 
-        char title[256];
-        int year;
-        char languages[256];
-        float rating;
-        char *ptr = line; // Pointer to traverse the line
-
-        // 1. Find the year (4 digits)
-        char *year_start = NULL;
-        for (int i = 0; i < strlen(ptr); ++i) {
-            if (isdigit(ptr[i]) && i + 3 < strlen(ptr) && // Check for 4 digits
-                isdigit(ptr[i+1]) && isdigit(ptr[i+2]) && isdigit(ptr[i+3])) {
-                year_start = &ptr[i];
-                break;
-            }
+    if (statistics) {
+        // Summaries only: rows go straight from the parser into fixed-size sketches
+        BlockSource* source = openInputSource(csvPath, reader);
+        if (source == NULL) {
+            return EXIT_FAILURE;
         }
-
-        if (year_start == NULL) {
-            fprintf(stderr, "Error: Could not find year in line: %s\n", line);
-            continue;
+        StreamingStats* stats = (StreamingStats*)calloc(1, sizeof(StreamingStats));
+        if (stats == NULL) {
+            perror("Failed to allocate memory for statistics");
+            return EXIT_FAILURE;
         }
-
-        // Extract title: from start of line to year_start - 1
-        int title_len = year_start - ptr;
-        if (title_len >= sizeof(title)) { // Prevent buffer overflow
-            fprintf(stderr, "Error: Title too long in line: %s\n", line);
-            continue;
+        LoadState state = {0};
+        state.rowSink = addRowToStats;
+        state.sinkContext = stats;
+        state.quarantine = &quarantine;
+        int rowCount = loadFromSource(source, &state);
+        source->close(source);
+        closeQuarantine(&quarantine);
+        if (rowCount >= 0) {
+            printf("Processed file %s and summarized data for %d movies\n\n", csvPath, rowCount);
+            printStreamingStats(stats);
         }
-        strncpy(title, ptr, title_len);
-        title[title_len] = '\0';
-        // Trim trailing spaces from title
-        for (int i = title_len - 1; i >= 0 && title[i] == ' '; --i) {
-            title[i] = '\0';
+        freeStreamingStats(stats);
+        free(stats);
+        return rowCount >= 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (profile) {
+        closeQuarantine(&quarantine);
+        return runProfile(csvPath, reader) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (streamQuery != NULL) {
+        // Answer one query while parsing, without loading the dataset
+        StreamQuery query;
+        if (parseStreamQuery(streamQuery, &query) != 0) {
+            fprintf(stderr, "Invalid query: %s\n", streamQuery);
+            closeQuarantine(&quarantine);
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
         }
+        int rowCount = runStreamQuery(csvPath, reader, &query, &options, &quarantine);
+        closeQuarantine(&quarantine);
+        return rowCount >= 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-        // Parse year
-        year = atoi(year_start);
+    Dataset dataset = {0};
+    int movieCount = 0;
+    int builderLock = -1;
 
-        // Move pointer past the year and any spaces
-        char *languages_start = year_start;
-        while (*languages_start != '\0' && isdigit(*languages_start)) {
-            languages_start++;
+    if (sharedName[0] != '\0') {
+        double start = nowSeconds();
+        movieCount = attachSharedDataset(sharedName, csvPath, &dataset);
+        if (movieCount < 0) {
+            // No ready segment for this CSV: become its builder, unless another
+            // process published one while this one waited for the lock
+            builderLock = lockSharedBuilder(sharedName);
+            if (builderLock >= 0 && (movieCount = attachSharedDataset(sharedName, csvPath, &dataset)) >= 0) {
+                close(builderLock);
+                builderLock = -1;
+            }
         }
-        while (*languages_start != '\0' && *languages_start == ' ') {
-            languages_start++;
+        if (dataset.sharedSegment != NULL) {
+            closeQuarantine(&quarantine);
+            printf("Attached to shared dataset %s (generation %lu) with %d movies in %.0f microseconds\n",
+                   sharedName, dataset.generation, movieCount, (nowSeconds() - start) * 1e6);
         }
+    }
 
-        // Find the languages block (starts with '[')
-        char *bracket_start = strchr(languages_start, '[');
-        if (bracket_start == NULL) {
-            fprintf(stderr, "Error: Could not find languages block in line: %s\n", line);
-            continue;
+    if (dataset.sharedSegment != NULL) {
+        // Attached above
+    } else if (lazy) {
+        movieCount = loadMappedFile(csvPath, &dataset, &quarantine);
+        closeQuarantine(&quarantine);
+        if (movieCount < 0) {
+            freeDataset(&dataset);
+            return EXIT_FAILURE;
         }
-        char *bracket_end = strchr(bracket_start, ']');
-        if (bracket_end == NULL) {
-            fprintf(stderr, "Error: Malformed languages block in line: %s\n", line);
-            continue;
+    } else {
+        BlockSource* source = openInputSource(csvPath, reader);
+        if (source == NULL) {
+            return EXIT_FAILURE;
         }
-
-        // Extract languages (including brackets for now, createMovieNode will clean)
-        int lang_len = bracket_end - bracket_start + 1;
-        if (lang_len >= sizeof(languages)) { // Prevent buffer overflow
-            fprintf(stderr, "Error: Languages string too long in line: %s\n", line);
-            continue;
+        LoadState state = {0};
+        state.dataset = &dataset;
+        state.quarantine = &quarantine;
+        movieCount = loadFromSource(source, &state);
+        source->close(source);
+        closeQuarantine(&quarantine);
+        if (movieCount < 0) {
+            freeDataset(&dataset);
+            return EXIT_FAILURE;
         }
-        strncpy(languages, bracket_start, lang_len);
-        languages[lang_len] = '\0';
+    }
 
+    if (dataset.sharedSegment == NULL) {
+        printf("Processed file %s and parsed data for %d movies\n", csvPath, movieCount);
+    }
+    if (builderLock >= 0) {
+        // Later processes attach to what this one parsed; a failure only costs them a parse
+        if (publishSharedDataset(sharedName, csvPath, &dataset) == 0) {
+            printf("Published shared dataset %s\n", sharedName);
+        }
+        close(builderLock);
+    }
 
-        // Move pointer past the languages block and any spaces
-        char *rating_start = bracket_end + 1;
-        while (*rating_start != '\0' && *rating_start == ' ') {
-            rating_start++;
+    if (joinPath != NULL) {
+        JoinInput joinInput;
+        if (loadJoinInput(joinPath, reader, &joinInput) != 0) {
+            freeJoinInput(&joinInput);
+            freeDataset(&dataset);
+            return EXIT_FAILURE;
         }
+        size_t matches = joinDataset(&dataset, &joinInput, options.workers);
+        printf("Joined %zu of %d movies with %zu rows of %s\n", matches, movieCount, joinInput.rowCount, joinPath);
+        freeJoinInput(&joinInput);
 
-        // Parse rating
-        rating = atof(rating_start);
+        if (options.sortKey == SORT_JOINED) {
+            size_t c = 0;
+            while (c < dataset.joinColumnCount && strcasecmp(dataset.joinColumnNames[c], options.sortColumnName) != 0) {
+                c++;
+            }
+            if (c == dataset.joinColumnCount) {
+                fprintf(stderr, "Unknown sort key: %s\n", options.sortColumnName);
+                freeDataset(&dataset);
+                return EXIT_FAILURE;
+            }
+            options.sortColumn = c;
+        }
+    }
 
-        // The "Value" column is the last part of the line, we don't need to parse it explicitly.
-        // If there's an actual 'Value' word after the rating, it will be ignored by atof.
+    // Scans run on the node that holds their rows from here on
+    placeDataset(&dataset);
 
-        // printf("DEBUG: Title='%s', Year=%d, Languages='%s', Rating=%.1f\n", title, year, languages, rating); // Debugging line
-        Movie* newMovie = createMovieNode(title, year, languages, rating);
-        addMovieToList(&head, newMovie);
-        movieCount++;
+    if (benchmark) {
+        runScanBenchmark(&dataset, &options);
+        freeDataset(&dataset);
+        return EXIT_SUCCESS;
     }
 
-    fclose(file);
+    if (batchPath != NULL) {
+        // One shared scan answers the whole batch, so the indexes are not worth building
+        int status = runBatchQueries(&dataset, batchPath, &options);
+        freeDataset(&dataset);
+        return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-    printf("Processed file %s and parsed data for %d movies\n", argv[1], movieCount);
+    if (dataset.sharedSegment == NULL) {
+        // An attached dataset is read-only: it answers from scans and its shared cube
+        buildDatasetIndex(&dataset);
+        if (dataset.cube == NULL) {
+            buildRatingCube(&dataset);
+        }
+    }
+    QueryCache cache;
+    initQueryCache(&cache, cacheMegabytes << 20);
 
     int choice;
     do {
@@ -353,22 +6552,44 @@ int main(int argc, char *argv[]) {
 
         switch (choice) {
             case 1:
-                showMoviesByYear(head);
+                showMoviesByYear(&dataset, &options, &cache);
                 break;
             case 2:
-                showHighestRatedMoviePerYear(head);
+                showHighestRatedMoviePerYear(&dataset, &options, &cache);
                 break;
             case 3:
-                showMoviesByLanguage(head);
+                showMoviesByLanguage(&dataset, &options, &cache);
                 break;
             case 4:
                 // Exit
                 break;
+            case 5:
+                showCacheStatistics(&cache);
+                break;
+            case 6:
+                showGroupedStatistics(&dataset, &options);
+                break;
+            case 7:
+                showFilteredMovies(&dataset, &options, &cache);
+                break;
+            case 8:
+                insertMovie(&dataset);
+                break;
+            case 9:
+                updateMovieRating(&dataset);
+                break;
+            case 10:
+                deleteMovie(&dataset);
+                break;
+            case 11:
+                showMovieCount(&dataset, &options);
+                break;
             default:
                 printf("You entered an incorrect choice. Try again.\n");
         }
     } while (choice != 4);
 
-    freeMovieList(head); // Free all allocated memory
+    freeQueryCache(&cache);
+    freeDataset(&dataset);
     return EXIT_SUCCESS;
 }
\ No newline at end of file